@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "chip8.h"
+#include "cli.h"
+#include "expand.h"
+#include "format.h"
+
+namespace
+{
+    const std::uint64_t DEFAULT_FRAMES = 200000;
+
+    // Scatters sprites made of its own code over the screen.
+    const std::vector<std::uint8_t> SCATTER_ROM = {
+        0xC0, 0x3F, // 200: RND V0, 3F
+        0xC1, 0x1F, // 202: RND V1, 1F
+        0xA2, 0x00, // 204: LD I, 200
+        0xD0, 0x1F, // 206: DRW V0, V1, 15
+        0x12, 0x00, // 208: JP 200
+    };
+
+    // Runs body frames times and returns the seconds taken. sink keeps the
+    // compiler from throwing the output away.
+    template<typename Body>
+    double measure(std::uint64_t frames, const std::vector<std::uint32_t>& pixels, Body body)
+    {
+        std::uint64_t sink = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (std::uint64_t i = 0; i < frames; i++) {
+            body();
+            sink += pixels[i % pixels.size()];
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        if (sink == 1) {
+            fmt::print("\n");
+        }
+
+        return elapsed.count();
+    }
+
+    void report(const char* name, double seconds, std::uint64_t frames, double baseline)
+    {
+        const auto pixels = static_cast<double>(frames * chip8::FRAMEBUFFER_SIZE);
+        fmt::print("{:24} {:8.3f} s  {:8.1f} Mpixels/s  {:6.2f}x\n", name, seconds, pixels / seconds / 1e6, baseline / seconds);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    auto frames = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : DEFAULT_FRAMES;
+
+    chip8::Chip8Context context;
+    context.loadROM(SCATTER_ROM);
+    context.run(5000);
+
+    const auto& rows = context.getFramebufferRows();
+    const auto bytes = context.getFramebuffer();
+
+    std::vector<std::uint32_t> pixels(chip8::FRAMEBUFFER_SIZE);
+
+    // What copyFramebuffer used to do: a fresh vector and a lambda per pixel.
+    auto baseline = measure(frames, pixels, [&]() {
+        std::vector<std::uint32_t> converted(bytes.size());
+        std::transform(bytes.cbegin(), bytes.cend(), converted.begin(),
+                       [](auto pixel) { return pixel ? 0xFFFFFFFF : 0; });
+        pixels.swap(converted);
+    });
+    report("transform lambda", baseline, frames, baseline);
+
+    // The same, starting from the packed framebuffer through the byte view.
+    auto viewed = measure(frames, pixels, [&]() {
+        const auto view = context.getFramebuffer();
+        std::vector<std::uint32_t> converted(view.size());
+        std::transform(view.cbegin(), view.cend(), converted.begin(),
+                       [](auto pixel) { return pixel ? 0xFFFFFFFF : 0; });
+        pixels.swap(converted);
+    });
+    report("byte view + lambda", viewed, frames, baseline);
+
+    for (auto kernel : { chip8::ExpandKernel::Scalar, chip8::ExpandKernel::Sse2, chip8::ExpandKernel::Avx2 }) {
+        if (!chip8::isExpandKernelSupported(kernel)) {
+            fmt::print("{:24} not supported on this host\n", chip8::getExpandKernelName(kernel));
+            continue;
+        }
+
+        auto packed = measure(frames, pixels, [&]() {
+            chip8::expandRows(rows.data(), rows.size(), pixels.data(), chip8::FRAMEBUFFER_WIDTH,
+                              chip8::DEFAULT_PALETTE, kernel);
+        });
+        report(fmt::format("{} packed", chip8::getExpandKernelName(kernel)).c_str(), packed, frames, baseline);
+
+        auto byteForm = measure(frames, pixels, [&]() {
+            chip8::expandBytes(bytes.data(), bytes.size(), pixels.data(), chip8::DEFAULT_PALETTE, kernel);
+        });
+        report(fmt::format("{} bytes", chip8::getExpandKernelName(kernel)).c_str(), byteForm, frames, baseline);
+    }
+
+    return 0;
+}
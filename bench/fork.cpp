@@ -0,0 +1,144 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "chip8.h"
+#include "format.h"
+
+namespace
+{
+    const unsigned DEFAULT_DEPTH = 6;
+    const std::uint64_t FRAMES_PER_MOVE = 4;
+    const std::uint64_t CYCLES_PER_FRAME = 10;
+
+    // Keypad states tried at every node: nothing, 5, 8, and both.
+    const std::uint16_t MOVES[] = { 0x0000, 0x0020, 0x0100, 0x0120 };
+
+    // Moves a sprite right while 5 is held and down while 8 is, leaving a
+    // trail, with a random value drawn each frame.
+    const std::vector<std::uint8_t> STEERING_ROM = {
+        0xA2, 0x1A, // 200: LD I, 21A
+        0x62, 0x05, // 202: LD V2, 5
+        0xE2, 0xA1, // 204: SKNP V2
+        0x70, 0x01, // 206: ADD V0, 1
+        0x62, 0x08, // 208: LD V2, 8
+        0xE2, 0xA1, // 20A: SKNP V2
+        0x71, 0x01, // 20C: ADD V1, 1
+        0xD0, 0x13, // 20E: DRW V0, V1, 3
+        0xC3, 0xFF, // 210: RND V3, FF
+        0x83, 0x04, // 212: ADD V3, V0
+        0x12, 0x02, // 214: JP 202
+        0x00, 0x00, // 216:
+        0x00, 0x00, // 218:
+        0xE0, 0xA0, // 21A: sprite
+        0xE0, 0x00,
+    };
+
+    using Branch = std::unique_ptr<chip8::Chip8Context>(*)(const chip8::Chip8Context& parent);
+
+    // Expands every node depth levels deep, one child per move, keeping
+    // them all alive. Returns the seconds spent branching.
+    double search(const chip8::Chip8Context& root, unsigned depth, Branch branch,
+                  std::vector<std::unique_ptr<chip8::Chip8Context>>& nodes)
+    {
+        std::chrono::duration<double> branching{ 0 };
+        std::vector<const chip8::Chip8Context*> frontier = { &root };
+
+        for (unsigned level = 0; level < depth; level++) {
+            std::vector<const chip8::Chip8Context*> next;
+
+            for (auto parent : frontier) {
+                for (auto keys : MOVES) {
+                    auto start = std::chrono::high_resolution_clock::now();
+                    nodes.push_back(branch(*parent));
+                    branching += std::chrono::high_resolution_clock::now() - start;
+
+                    auto& child = *nodes.back();
+                    child.setKeys(keys);
+
+                    for (std::uint64_t frame = 0; frame < FRAMES_PER_MOVE; frame++) {
+                        child.runFrame(CYCLES_PER_FRAME);
+                    }
+
+                    next.push_back(&child);
+                }
+            }
+
+            frontier = std::move(next);
+        }
+
+        return branching.count();
+    }
+
+    void report(const char* name, double seconds, const std::vector<std::unique_ptr<chip8::Chip8Context>>& nodes,
+                std::uint64_t leafHash)
+    {
+        std::size_t bytes = 0;
+        for (const auto& node : nodes) {
+            bytes += sizeof(chip8::Chip8Context) + node->getUnsharedMemoryBytes();
+        }
+
+        fmt::print("{:6} {:7} nodes  {:10.0f} branches/s  {:8.0f} bytes per live context  leaves {:016x}\n",
+                   name, nodes.size(), nodes.size() / seconds, static_cast<double>(bytes) / nodes.size(), leafHash);
+    }
+
+    std::uint64_t hashLeaves(const std::vector<std::unique_ptr<chip8::Chip8Context>>& nodes, std::size_t leaves)
+    {
+        std::uint64_t hash = 0;
+        for (auto node = nodes.end() - leaves; node != nodes.end(); ++node) {
+            hash = hash * 31 + chip8::hashFramebuffer((*node)->getFramebufferRows()) + (*node)->getPC();
+        }
+
+        return hash;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    auto depth = argc > 1 ? static_cast<unsigned>(std::strtoul(argv[1], nullptr, 10)) : DEFAULT_DEPTH;
+
+    chip8::Chip8Context root;
+    root.loadROM(STEERING_ROM);
+    root.setCore(chip8::Core::Threaded);
+    root.runFrame(CYCLES_PER_FRAME);
+
+    std::size_t leaves = 1;
+    for (unsigned level = 0; level < depth; level++) {
+        leaves *= sizeof(MOVES) / sizeof(MOVES[0]);
+    }
+
+    fmt::print("{} moves, depth {}, {} frames per move; a standalone context is {} bytes\n",
+               sizeof(MOVES) / sizeof(MOVES[0]), depth, FRAMES_PER_MOVE,
+               sizeof(chip8::Chip8Context) + root.getUnsharedMemoryBytes());
+
+    // What branching took without fork(): a fresh context given the ROM and
+    // the parent's state.
+    {
+        std::vector<std::unique_ptr<chip8::Chip8Context>> nodes;
+        auto seconds = search(root, depth, [](const chip8::Chip8Context& parent) {
+            static chip8::State state;
+            parent.saveState(state);
+
+            auto child = std::make_unique<chip8::Chip8Context>();
+            child->loadROM(STEERING_ROM);
+            child->setCore(parent.getCore());
+            child->loadState(state);
+            return child;
+        }, nodes);
+
+        report("copy", seconds, nodes, hashLeaves(nodes, leaves));
+    }
+
+    {
+        std::vector<std::unique_ptr<chip8::Chip8Context>> nodes;
+        auto seconds = search(root, depth, [](const chip8::Chip8Context& parent) {
+            return parent.fork();
+        }, nodes);
+
+        report("fork", seconds, nodes, hashLeaves(nodes, leaves));
+    }
+
+    return 0;
+}
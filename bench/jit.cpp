@@ -0,0 +1,89 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "chip8.h"
+#include "cli.h"
+#include "format.h"
+#include "jit.h"
+
+namespace
+{
+    const std::uint64_t DEFAULT_INSTRUCTIONS = 50000000;
+
+    // Register shuffling in a counted loop with a sprite draw every 256
+    // iterations: mostly JIT-friendly code with the odd interpreted instruction.
+    const std::vector<std::uint8_t> SYNTHETIC_ROM = {
+        0x60, 0x00, // 200: LD V0, 0
+        0x61, 0x01, // 202: LD V1, 1
+        0x62, 0x03, // 204: LD V2, 3
+        0x80, 0x14, // 206: ADD V0, V1
+        0x83, 0x00, // 208: LD V3, V0
+        0x83, 0x22, // 20A: AND V3, V2
+        0x84, 0x05, // 20C: SUB V4, V0
+        0x84, 0x3E, // 20E: SHL V4, V3
+        0x75, 0x07, // 210: ADD V5, 7
+        0x85, 0x43, // 212: XOR V5, V4
+        0xF5, 0x1E, // 214: ADD I, V5
+        0x30, 0x00, // 216: SE V0, 0
+        0x12, 0x06, // 218: JP 206
+        0xA3, 0x00, // 21A: LD I, 300
+        0xD5, 0x45, // 21C: DRW V5, V4, 5
+        0x12, 0x06, // 21E: JP 206
+    };
+
+    double measure(const std::vector<std::uint8_t>& rom, chip8::Core core, std::uint64_t instructions, bool useTick)
+    {
+        chip8::Chip8Context context;
+        context.loadROM(rom);
+        context.setCore(core);
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        if (useTick) {
+            for (std::uint64_t i = 0; i < instructions; i++) {
+                context.tick();
+            }
+        } else {
+            context.run(instructions);
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        if (core == chip8::Core::Jit && context.getJit()) {
+            const auto& stats = context.getJit()->getStats();
+            fmt::print("  jit: {} blocks, {} native / {} interpreted instructions\n",
+                       stats.blocksCompiled, stats.nativeInstructions, stats.interpretedInstructions);
+        }
+
+        return elapsed.count();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::uint8_t> rom = SYNTHETIC_ROM;
+
+    if (argc > 1 && !chip8::readFile(argv[1], rom)) {
+        fmt::print("Couldn't load ROM {}\n", argv[1]);
+        return 1;
+    }
+
+    auto instructions = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : DEFAULT_INSTRUCTIONS;
+
+    if (!chip8::Jit::isSupported()) {
+        fmt::print("Note: the JIT isn't supported on this host, Core::Jit runs the threaded interpreter\n");
+    }
+
+    auto baseline = measure(rom, chip8::Core::Table, instructions, true);
+    fmt::print("tick():          {:8.3f} s  {:8.1f} MIPS\n", baseline, instructions / baseline / 1e6);
+
+    auto threaded = measure(rom, chip8::Core::Threaded, instructions, false);
+    fmt::print("threaded run():  {:8.3f} s  {:8.1f} MIPS  {:5.2f}x\n", threaded, instructions / threaded / 1e6, baseline / threaded);
+
+    auto jit = measure(rom, chip8::Core::Jit, instructions, false);
+    fmt::print("jit run():       {:8.3f} s  {:8.1f} MIPS  {:5.2f}x\n", jit, instructions / jit / 1e6, baseline / jit);
+
+    return 0;
+}
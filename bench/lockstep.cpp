@@ -0,0 +1,95 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "chip8.h"
+#include "cli.h"
+#include "format.h"
+#include "lockstep.h"
+
+namespace
+{
+    const std::uint64_t DEFAULT_INSTRUCTIONS = 2000000;
+
+    // ALU work in a loop, with a random skip that sends a lane down a
+    // slightly longer path about one time in eight before the paths merge.
+    const std::vector<std::uint8_t> SYNTHETIC_ROM = {
+        0xC0, 0x07, // 200: RND V0, 07
+        0x30, 0x00, // 202: SE V0, 0
+        0x12, 0x08, // 204: JP 208
+        0x73, 0x01, // 206: ADD V3, 1
+        0x71, 0x01, // 208: ADD V1, 1
+        0x82, 0x14, // 20A: ADD V2, V1
+        0x84, 0x20, // 20C: LD V4, V2
+        0x84, 0x32, // 20E: AND V4, V3
+        0x85, 0x45, // 210: SUB V5, V4
+        0x85, 0x1E, // 212: SHL V5, V1
+        0x86, 0x53, // 214: XOR V6, V5
+        0xF6, 0x1E, // 216: ADD I, V6
+        0x12, 0x00, // 218: JP 200
+    };
+
+    // Runs lanes separate contexts one after the other.
+    double measureScalar(const std::vector<std::uint8_t>& rom, std::size_t lanes, std::uint64_t instructions)
+    {
+        std::vector<std::unique_ptr<chip8::Chip8Context>> contexts;
+
+        for (std::size_t lane = 0; lane < lanes; lane++) {
+            contexts.push_back(std::make_unique<chip8::Chip8Context>());
+            contexts.back()->loadROM(rom);
+            contexts.back()->setCore(chip8::Core::Threaded);
+            contexts.back()->seedRandom(static_cast<std::uint32_t>(lane));
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (auto& context : contexts) {
+            context->run(instructions);
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        return elapsed.count();
+    }
+
+    template<std::size_t Lanes>
+    void compare(const std::vector<std::uint8_t>& rom, std::uint64_t instructions)
+    {
+        auto lockstep = std::make_unique<chip8::Lockstep<Lanes>>();
+        lockstep->loadROM(rom);
+
+        for (std::size_t lane = 0; lane < Lanes; lane++) {
+            lockstep->seedRandom(lane, static_cast<std::uint32_t>(lane));
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        lockstep->run(instructions);
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        auto scalar = measureScalar(rom, Lanes, instructions);
+        const auto total = static_cast<double>(instructions * Lanes);
+
+        fmt::print("{:2} lanes: threaded {:8.1f} MIPS, lockstep {:8.1f} MIPS  {:5.2f}x, {:5.1f}% lane utilisation\n",
+                   Lanes, total / scalar / 1e6, total / elapsed.count() / 1e6, scalar / elapsed.count(),
+                   lockstep->getStats().getUtilisation(Lanes) * 100);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::uint8_t> rom = SYNTHETIC_ROM;
+
+    if (argc > 1 && !chip8::readFile(argv[1], rom)) {
+        fmt::print("Couldn't load ROM {}\n", argv[1]);
+        return 1;
+    }
+
+    auto instructions = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : DEFAULT_INSTRUCTIONS;
+
+    compare<8>(rom, instructions);
+    compare<16>(rom, instructions);
+    compare<32>(rom, instructions);
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "chip8.h"
+#include "cli.h"
+#include "format.h"
+#include "rewind.h"
+
+namespace
+{
+    const std::uint64_t DEFAULT_SECONDS = 60;
+    const std::uint64_t CYCLES_PER_FRAME = 10;
+
+    // Scatters sprites made of its own code over the screen, so most frames
+    // change a good part of the picture.
+    const std::vector<std::uint8_t> SCATTER_ROM = {
+        0xC0, 0x3F, // 200: RND V0, 3F
+        0xC1, 0x1F, // 202: RND V1, 1F
+        0xA2, 0x00, // 204: LD I, 200
+        0xD0, 0x1F, // 206: DRW V0, V1, 15
+        0x12, 0x00, // 208: JP 200
+    };
+
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::uint8_t> rom = SCATTER_ROM;
+
+    if (argc > 1 && !chip8::readFile(argv[1], rom)) {
+        fmt::print("Couldn't load ROM {}\n", argv[1]);
+        return 1;
+    }
+
+    const auto seconds = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : DEFAULT_SECONDS;
+    const auto frames = seconds * chip8::TIMER_FREQUENCY;
+
+    chip8::Chip8Context context;
+    context.loadROM(rom);
+    context.setCore(chip8::Core::Threaded);
+
+    chip8::RewindBuffer rewind(frames);
+
+    // Fill it twice over, so the second half is measured with the oldest
+    // groups being recycled.
+    std::chrono::duration<double> frameTime{ 0 };
+
+    for (std::uint64_t frame = 0; frame < frames * 2; frame++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        context.runFrame(CYCLES_PER_FRAME);
+        frameTime += std::chrono::high_resolution_clock::now() - start;
+
+        rewind.push(context);
+    }
+
+    const auto& stats = rewind.getStats();
+    std::chrono::duration<double, std::nano> encodeTime = stats.encodeTime;
+
+    fmt::print("{} frames held ({:.1f} s) in {:.1f} KB, {:.1f} bytes/frame encoded, 1 keyframe in {}\n",
+               rewind.size(), static_cast<double>(rewind.size()) / chip8::TIMER_FREQUENCY,
+               rewind.getMemoryUsage() / 1024.0, static_cast<double>(stats.encodedBytes) / stats.frames,
+               stats.frames / stats.keyframes);
+
+    fmt::print("push      {:8.1f} ns/frame ({:.1f}% of emulating a {} instruction frame)\n",
+               encodeTime.count() / stats.frames,
+               encodeTime.count() / 1e9 / frameTime.count() * 100, CYCLES_PER_FRAME);
+
+    // Scrubbing back and forth, as a front end would while seeking.
+    chip8::State state;
+    const auto peeks = rewind.size() * 4;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (std::size_t i = 0; i < peeks; i++) {
+        const auto sweep = i % (rewind.size() * 2);
+        rewind.peek(sweep < rewind.size() ? sweep : rewind.size() * 2 - 1 - sweep, state);
+    }
+
+    std::chrono::duration<double, std::nano> peekTime = std::chrono::high_resolution_clock::now() - start;
+    fmt::print("peek      {:8.1f} ns/frame\n", peekTime.count() / peeks);
+
+    const auto steps = rewind.size() - 1;
+    start = std::chrono::high_resolution_clock::now();
+
+    while (rewind.stepBack(state)) {
+        context.loadState(state);
+    }
+
+    std::chrono::duration<double, std::nano> stepTime = std::chrono::high_resolution_clock::now() - start;
+    fmt::print("stepBack  {:8.1f} ns/frame including loadState\n", stepTime.count() / steps);
+
+    return 0;
+}
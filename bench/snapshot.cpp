@@ -0,0 +1,110 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+#include "chip8.h"
+#include "format.h"
+#include "state.h"
+
+namespace
+{
+    const std::uint64_t DEFAULT_SNAPSHOTS = 200000;
+    const std::uint64_t CYCLES_PER_FRAME = 10;
+
+    // Scatters sprites made of its own code over the screen.
+    const std::vector<std::uint8_t> SCATTER_ROM = {
+        0xC0, 0x3F, // 200: RND V0, 3F
+        0xC1, 0x1F, // 202: RND V1, 1F
+        0xA2, 0x00, // 204: LD I, 200
+        0xD0, 0x1F, // 206: DRW V0, V1, 15
+        0x12, 0x00, // 208: JP 200
+    };
+
+    // Runs body count times and returns the seconds taken.
+    template<typename Body>
+    double measure(std::uint64_t count, Body body)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (std::uint64_t i = 0; i < count; i++) {
+            body(i);
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        return elapsed.count();
+    }
+
+    void report(const char* name, double seconds, std::uint64_t count)
+    {
+        fmt::print("{:28} {:8.3f} s  {:12.0f} /s  {:8.1f} ns each\n", name, seconds, count / seconds,
+                   seconds / count * 1e9);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    auto count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : DEFAULT_SNAPSHOTS;
+
+    chip8::Chip8Context context;
+    context.loadROM(SCATTER_ROM);
+    context.run(5000);
+
+    // Two states a frame apart, so loads really change the registers and
+    // the picture.
+    chip8::State states[2];
+    context.saveState(states[0]);
+    context.runFrame(CYCLES_PER_FRAME);
+    context.saveState(states[1]);
+
+    report("save", measure(count, [&](std::uint64_t i) {
+        context.saveState(states[i & 1]);
+    }), count);
+
+    context.saveState(states[1]);
+    context.runFrame(CYCLES_PER_FRAME);
+    context.saveState(states[0]);
+
+    report("load", measure(count, [&](std::uint64_t i) {
+        context.loadState(states[i & 1]);
+    }), count);
+
+    // What rewinding or running ahead does every frame.
+    const auto frames = measure(count, [&](std::uint64_t) {
+        context.runFrame(CYCLES_PER_FRAME);
+    });
+    report("frame", frames, count);
+
+    const auto framesWithSnapshots = measure(count, [&](std::uint64_t i) {
+        context.saveState(states[i & 1]);
+        context.runFrame(CYCLES_PER_FRAME);
+    });
+    report("frame + save", framesWithSnapshots, count);
+
+    // A state from a different ROM, which means redecoding memory.
+    chip8::State other = states[0];
+    other.memory[chip8::ROM_LOAD_ADDR + 1] ^= 0x01;
+    const auto redecodes = count / 100 + 1;
+
+    report("load other ROM", measure(redecodes, [&](std::uint64_t i) {
+        context.loadState(i & 1 ? states[0] : other);
+    }), redecodes);
+
+    std::stringstream stream;
+    report("write file", measure(count, [&](std::uint64_t) {
+        stream.seekp(0);
+        chip8::writeState(stream, states[0]);
+    }), count);
+
+    report("read file", measure(count, [&](std::uint64_t i) {
+        stream.seekg(0);
+        chip8::readState(stream, states[i & 1]);
+    }), count);
+
+    fmt::print("{} bytes in memory, {} on disk; saving every frame costs {:.1f}% of a {} instruction frame\n",
+               sizeof(chip8::State), chip8::STATE_FILE_SIZE, (framesWithSnapshots - frames) / frames * 100,
+               CYCLES_PER_FRAME);
+
+    return 0;
+}
@@ -0,0 +1,488 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <experimental/filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "chip8.h"
+#include "cli.h"
+#include "expand.h"
+#include "format.h"
+#include "jit.h"
+
+namespace fs = std::experimental::filesystem;
+
+// Every benchmark in one run, each timed over several samples so results
+// come with their spread, written as JSON for tracking over time. make
+// bench runs it over the ROMs in roms/.
+
+namespace
+{
+    const unsigned DEFAULT_SAMPLES = 10;
+    const double DEFAULT_SAMPLE_SECONDS = 0.02;
+    const std::uint64_t DEFAULT_FRAMES = 600;
+    const std::uint64_t CYCLES_PER_FRAME = 10;
+
+    // Instructions per run() call in the dispatch benchmarks.
+    const std::uint64_t DISPATCH_BATCH = 1000;
+
+    // Bumped whenever the JSON changes shape.
+    const unsigned RESULTS_VERSION = 1;
+
+    volatile std::uint64_t sink;
+
+    struct Options
+    {
+        unsigned samples = DEFAULT_SAMPLES;
+        double sampleSeconds = DEFAULT_SAMPLE_SECONDS;
+        std::uint64_t frames = DEFAULT_FRAMES;
+        const char* filter = nullptr;
+        const char* outputPath = nullptr;
+        std::vector<const char*> romPaths;
+    };
+
+    struct Mix
+    {
+        const char* name;
+        std::vector<std::uint8_t> rom;
+    };
+
+    // Endless loops of one kind of work each, for the dispatch benchmarks.
+    const Mix MIXES[] = {
+        { "alu", {
+            0x60, 0x01, // 200: LD V0, 1
+            0x71, 0x03, // 202: ADD V1, 3
+            0x82, 0x10, // 204: LD V2, V1
+            0x82, 0x03, // 206: XOR V2, V0
+            0x83, 0x24, // 208: ADD V3, V2
+            0x83, 0x06, // 20A: SHR V3
+            0x84, 0x31, // 20C: OR V4, V3
+            0x84, 0x12, // 20E: AND V4, V1
+            0x85, 0x45, // 210: SUB V5, V4
+            0x12, 0x00, // 212: JP 200
+        } },
+        { "branch", {
+            0x70, 0x01, // 200: ADD V0, 1
+            0x30, 0x80, // 202: SE V0, 80
+            0x12, 0x00, // 204: JP 200
+            0x41, 0x00, // 206: SNE V1, 0
+            0x60, 0x00, // 208: LD V0, 0
+            0x12, 0x00, // 20A: JP 200
+        } },
+        { "call", {
+            0x22, 0x06, // 200: CALL 206
+            0x70, 0x01, // 202: ADD V0, 1
+            0x12, 0x00, // 204: JP 200
+            0x71, 0x01, // 206: ADD V1, 1
+            0x00, 0xEE, // 208: RET
+        } },
+        { "index", {
+            0xA3, 0x00, // 200: LD I, 300
+            0xF0, 0x1E, // 202: ADD I, V0
+            0xC0, 0x0F, // 204: RND V0, 0F
+            0xF0, 0x18, // 206: LD ST, V0
+            0xE1, 0x9E, // 208: SKP V1
+            0x12, 0x00, // 20A: JP 200
+        } },
+    };
+
+    // Eight sprites then a jump back, so DRW is most of what runs.
+    std::vector<std::uint8_t> makeDrawROM(std::uint8_t height)
+    {
+        std::vector<std::uint8_t> rom;
+
+        for (int i = 0; i < 8; i++) {
+            rom.push_back(0xD0);
+            rom.push_back(0x10 | height);
+        }
+
+        rom.push_back(0x12);
+        rom.push_back(0x00);
+
+        return rom;
+    }
+
+    struct Result
+    {
+        std::string name;
+        const char* unit;
+        std::uint64_t iterations;
+
+        // Time per operation in each sample, in the unit.
+        std::vector<double> samples;
+
+        double mean = 0;
+        double stddev = 0;
+        double min = 0;
+        double median = 0;
+        double max = 0;
+    };
+
+    class Suite
+    {
+    public:
+        explicit Suite(const Options& options)
+            : m_options(options)
+        {
+        }
+
+        // Times body(iterations), which does operationsPerIteration
+        // operations each iteration, in nanoseconds per operation. The
+        // iteration count is doubled until a sample takes long enough to
+        // time, then one sample is thrown away to warm up and the rest are
+        // kept.
+        template<typename Body>
+        void run(const std::string& name, const char* unit, std::uint64_t operationsPerIteration, Body body)
+        {
+            if (m_options.filter && name.find(m_options.filter) == std::string::npos) {
+                return;
+            }
+
+            std::uint64_t iterations = 1;
+            while (time(iterations, body) < m_options.sampleSeconds && iterations < (1ull << 40)) {
+                iterations *= 2;
+            }
+
+            Result result;
+            result.name = name;
+            result.unit = unit;
+            result.iterations = iterations;
+
+            time(iterations, body);
+
+            for (unsigned sample = 0; sample < m_options.samples; sample++) {
+                result.samples.push_back(time(iterations, body) * 1e9 / (iterations * operationsPerIteration));
+            }
+
+            summarise(result);
+
+            fmt::print("{:40} {:12.2f} {:16} +/- {:5.1f}%  (min {:.2f}, max {:.2f})\n",
+                       result.name, result.mean, result.unit,
+                       result.mean > 0 ? result.stddev / result.mean * 100 : 0.0, result.min, result.max);
+
+            m_results.push_back(std::move(result));
+        }
+
+        void writeJson(std::FILE* out) const
+        {
+            fmt::print(out, "{{\n  \"version\": {},\n  \"compiler\": {},\n  \"profiling\": {},\n"
+                       "  \"samples\": {},\n  \"sample_seconds\": {},\n  \"results\": [",
+                       RESULTS_VERSION, chip8::quoteJson(__VERSION__), chip8::PROFILING ? "true" : "false",
+                       m_options.samples, m_options.sampleSeconds);
+
+            for (std::size_t index = 0; index < m_results.size(); index++) {
+                const auto& result = m_results[index];
+
+                fmt::print(out, "{}\n    {{\"name\": {}, \"unit\": \"{}\", \"iterations\": {}, \"mean\": {:.4f}, "
+                           "\"stddev\": {:.4f}, \"min\": {:.4f}, \"median\": {:.4f}, \"max\": {:.4f}, \"samples\": [",
+                           index ? "," : "", chip8::quoteJson(result.name), result.unit, result.iterations, result.mean,
+                           result.stddev, result.min, result.median, result.max);
+
+                for (std::size_t sample = 0; sample < result.samples.size(); sample++) {
+                    fmt::print(out, "{}{:.4f}", sample ? ", " : "", result.samples[sample]);
+                }
+
+                fmt::print(out, "]}}");
+            }
+
+            fmt::print(out, "\n  ]\n}}\n");
+        }
+
+    private:
+        const Options& m_options;
+        std::vector<Result> m_results;
+
+        template<typename Body>
+        static double time(std::uint64_t iterations, Body& body)
+        {
+            auto start = std::chrono::steady_clock::now();
+            body(iterations);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            return elapsed.count();
+        }
+
+        static void summarise(Result& result)
+        {
+            auto sorted = result.samples;
+            std::sort(sorted.begin(), sorted.end());
+
+            const auto count = sorted.size();
+            if (count == 0) {
+                return;
+            }
+
+            double sum = 0;
+            for (auto value : sorted) {
+                sum += value;
+            }
+
+            result.mean = sum / count;
+
+            double squares = 0;
+            for (auto value : sorted) {
+                squares += (value - result.mean) * (value - result.mean);
+            }
+
+            // Sample standard deviation, as these are a sample of the runs
+            // the machine could have made.
+            result.stddev = count > 1 ? std::sqrt(squares / (count - 1)) : 0.0;
+            result.min = sorted.front();
+            result.max = sorted.back();
+            result.median = count % 2 ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+        }
+    };
+
+    // Puts V0 and V1 at x and y, and I on the sprite data.
+    void placeSprite(chip8::Chip8Context& context, std::uint8_t x, std::uint8_t y)
+    {
+        chip8::State state;
+        context.saveState(state);
+        state.V[0] = x;
+        state.V[1] = y;
+        state.I = chip8::ROM_LOAD_ADDR;
+        context.loadState(state);
+    }
+
+    void benchDispatch(Suite& suite)
+    {
+        for (const auto& mix : MIXES) {
+            // tick() is one instruction through the whole of run() each time.
+            {
+                chip8::Chip8Context context;
+                context.loadROM(mix.rom);
+
+                suite.run(fmt::format("dispatch/{}/tick", mix.name), "ns/instruction", DISPATCH_BATCH,
+                          [&](std::uint64_t iterations) {
+                    for (std::uint64_t i = 0; i < iterations * DISPATCH_BATCH; i++) {
+                        context.tick();
+                    }
+                });
+            }
+
+            for (auto core : { chip8::Core::Table, chip8::Core::Threaded, chip8::Core::Jit }) {
+                if (core == chip8::Core::Jit && !chip8::Jit::isSupported()) {
+                    continue;
+                }
+
+                chip8::Chip8Context context;
+                context.loadROM(mix.rom);
+                context.setCore(core);
+
+                suite.run(fmt::format("dispatch/{}/{}", mix.name, chip8::getCoreName(core)), "ns/instruction",
+                          DISPATCH_BATCH, [&](std::uint64_t iterations) {
+                    for (std::uint64_t i = 0; i < iterations; i++) {
+                        context.run(DISPATCH_BATCH);
+                    }
+                });
+            }
+        }
+    }
+
+    void benchDraw(Suite& suite)
+    {
+        struct Placement
+        {
+            const char* name;
+            std::uint8_t x;
+            std::uint8_t y;
+        };
+
+        // Byte aligned, straddling two bytes, and over both edges.
+        const Placement placements[] = {
+            { "aligned", 8, 4 },
+            { "unaligned", 13, 4 },
+            { "wrap", 60, 28 },
+        };
+
+        // 9 instructions a loop, 8 of them sprites.
+        const std::uint64_t loops = DISPATCH_BATCH / 9;
+
+        for (std::uint8_t height : { 1, 5, 8, 15 }) {
+            for (const auto& placement : placements) {
+                chip8::Chip8Context context;
+                context.loadROM(makeDrawROM(height));
+                context.setCore(chip8::Core::Threaded);
+                placeSprite(context, placement.x, placement.y);
+
+                suite.run(fmt::format("drw/h{}/{}", height, placement.name), "ns/sprite", loops * 8,
+                          [&](std::uint64_t iterations) {
+                    for (std::uint64_t i = 0; i < iterations; i++) {
+                        context.run(loops * 9);
+                    }
+
+                    sink = context.getFramebufferGeneration();
+                });
+            }
+        }
+    }
+
+    void benchExpand(Suite& suite)
+    {
+        chip8::Chip8Context context;
+        context.loadROM(makeDrawROM(15));
+        context.seedRandom(1);
+
+        // A busy picture, as there's nothing to skip either way.
+        for (std::uint8_t i = 0; i < 64; i++) {
+            placeSprite(context, static_cast<std::uint8_t>(i * 7), static_cast<std::uint8_t>(i * 3));
+            context.run(1);
+        }
+
+        const auto& rows = context.getFramebufferRows();
+        std::vector<std::uint32_t> pixels(chip8::FRAMEBUFFER_SIZE);
+
+        for (auto kernel : { chip8::ExpandKernel::Scalar, chip8::ExpandKernel::Sse2, chip8::ExpandKernel::Avx2 }) {
+            if (!chip8::isExpandKernelSupported(kernel)) {
+                continue;
+            }
+
+            suite.run(fmt::format("expand/{}", chip8::getExpandKernelName(kernel)), "ns/frame", 1, [&](std::uint64_t iterations) {
+                for (std::uint64_t i = 0; i < iterations; i++) {
+                    chip8::expandRows(rows.data(), rows.size(), pixels.data(), chip8::FRAMEBUFFER_WIDTH,
+                                      chip8::DEFAULT_PALETTE, kernel);
+                    sink = pixels[i % pixels.size()];
+                }
+            });
+        }
+    }
+
+    void benchState(Suite& suite)
+    {
+        chip8::Chip8Context context;
+        context.loadROM(makeDrawROM(15));
+        context.setCore(chip8::Core::Threaded);
+        context.run(5000);
+
+        // Two states a frame apart, so loads really change something.
+        chip8::State states[2];
+        context.saveState(states[0]);
+        context.runFrame(CYCLES_PER_FRAME);
+        context.saveState(states[1]);
+
+        suite.run("state/save", "ns/save", 1, [&](std::uint64_t iterations) {
+            for (std::uint64_t i = 0; i < iterations; i++) {
+                context.saveState(states[i & 1]);
+            }
+        });
+
+        suite.run("state/load", "ns/load", 1, [&](std::uint64_t iterations) {
+            for (std::uint64_t i = 0; i < iterations; i++) {
+                context.loadState(states[i & 1]);
+            }
+        });
+
+        chip8::Chip8Context child;
+        suite.run("state/fork", "ns/fork", 1, [&](std::uint64_t iterations) {
+            for (std::uint64_t i = 0; i < iterations; i++) {
+                context.fork(child);
+            }
+        });
+    }
+
+    // Whole ROMs from power-on for a fixed number of frames, as a front end
+    // would run them.
+    void benchROMs(Suite& suite, const Options& options)
+    {
+        for (auto path : options.romPaths) {
+            std::vector<std::uint8_t> rom;
+            if (!chip8::readFile(path, rom)) {
+                fmt::print("Couldn't load ROM {}\n", path);
+                continue;
+            }
+
+            const auto name = fs::path(path).stem().string();
+
+            // Benchmarks aren't linked with the AOT translations, so Aot would
+            // only time the threaded core again.
+            for (auto core : { chip8::Core::Table, chip8::Core::Threaded, chip8::Core::Jit }) {
+                if (core == chip8::Core::Jit && !chip8::Jit::isSupported()) {
+                    continue;
+                }
+
+                suite.run(fmt::format("rom/{}/{}", name, chip8::getCoreName(core)), "ns/frame", options.frames,
+                          [&](std::uint64_t iterations) {
+                    for (std::uint64_t i = 0; i < iterations; i++) {
+                        chip8::Chip8Context context;
+                        context.loadROM(rom);
+                        context.setCore(core);
+
+                        for (std::uint64_t frame = 0; frame < options.frames; frame++) {
+                            context.runFrame(CYCLES_PER_FRAME);
+                        }
+
+                        sink = context.getFramebufferGeneration();
+                    }
+                });
+            }
+        }
+    }
+
+    bool parseOptions(int argc, char* argv[], Options& options)
+    {
+        for (int i = 1; i < argc; i++) {
+            const char* arg = argv[i];
+            const bool hasValue = i + 1 < argc;
+
+            if (std::strcmp(arg, "--samples") == 0 && hasValue) {
+                options.samples = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 0));
+            } else if (std::strcmp(arg, "--sample-time") == 0 && hasValue) {
+                options.sampleSeconds = std::strtod(argv[++i], nullptr) / 1000;
+            } else if (std::strcmp(arg, "--frames") == 0 && hasValue) {
+                options.frames = std::strtoull(argv[++i], nullptr, 0);
+            } else if (std::strcmp(arg, "--filter") == 0 && hasValue) {
+                options.filter = argv[++i];
+            } else if (std::strcmp(arg, "--output") == 0 && hasValue) {
+                options.outputPath = argv[++i];
+            } else if (arg[0] != '-') {
+                options.romPaths.push_back(arg);
+            } else {
+                return false;
+            }
+        }
+
+        return options.samples > 0 && options.frames > 0;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        fmt::print("Usage: {} [options] [ROM...]\n"
+                   "  --samples N      timed samples per benchmark (default {})\n"
+                   "  --sample-time T  milliseconds each sample should take at least (default {:.0f})\n"
+                   "  --frames N       frames per ROM run (default {})\n"
+                   "  --filter S       only run benchmarks with S in their name\n"
+                   "  --output F       write the results to F as JSON\n",
+                   argv[0], DEFAULT_SAMPLES, DEFAULT_SAMPLE_SECONDS * 1000, DEFAULT_FRAMES);
+        return 1;
+    }
+
+    Suite suite(options);
+
+    benchDispatch(suite);
+    benchDraw(suite);
+    benchExpand(suite);
+    benchState(suite);
+    benchROMs(suite, options);
+
+    if (options.outputPath) {
+        auto file = std::unique_ptr<std::FILE, decltype(&std::fclose)>(std::fopen(options.outputPath, "w"),
+                                                                       std::fclose);
+        if (!file) {
+            fmt::print("Couldn't write the results to {}\n", options.outputPath);
+            return 1;
+        }
+
+        suite.writeJson(file.get());
+    }
+
+    return 0;
+}
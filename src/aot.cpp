@@ -0,0 +1,50 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "aot.h"
+
+namespace
+{
+    // Function-local so registration from other translation units' static
+    // initializers doesn't depend on initialization order.
+    std::vector<chip8::AotProgram>& programs()
+    {
+        static std::vector<chip8::AotProgram> registered;
+        return registered;
+    }
+}
+
+namespace chip8
+{
+    std::uint64_t hashROM(const std::uint8_t* data, std::size_t size)
+    {
+        // 64-bit FNV-1a.
+        std::uint64_t hash = 0xCBF29CE484222325ull;
+
+        for (std::size_t i = 0; i < size; i++) {
+            hash ^= data[i];
+            hash *= 0x100000001B3ull;
+        }
+
+        return hash;
+    }
+
+    const AotProgram* findAotProgram(const std::vector<std::uint8_t>& rom)
+    {
+        const auto hash = hashROM(rom.data(), rom.size());
+        const auto& registered = programs();
+
+        auto it = std::find_if(registered.cbegin(), registered.cend(), [&](const AotProgram& program) {
+            return program.romHash == hash && program.romSize == rom.size();
+        });
+
+        return it != registered.cend() ? &*it : nullptr;
+    }
+
+    AotRegistration::AotRegistration(const AotProgram& program)
+    {
+        programs().push_back(program);
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "chip8.h"
+
+namespace chip8
+{
+    // Entry point of a ROM translated to C++ by chip8-recompile. Executes up to
+    // budget instructions starting from the context's PC with the same early
+    // stops as Chip8Context::run(), and returns how many were executed.
+    using AotEntry = std::uint64_t(*)(Chip8Context& context, std::uint64_t budget);
+
+    struct AotProgram
+    {
+        const char* name;
+        std::uint64_t romHash;
+        std::size_t romSize;
+        AotEntry entry;
+    };
+
+    std::uint64_t hashROM(const std::uint8_t* data, std::size_t size);
+
+    // Finds a translated program built from exactly this ROM image, if one was
+    // linked in.
+    const AotProgram* findAotProgram(const std::vector<std::uint8_t>& rom);
+
+    // Generated translation units register their program with a static
+    // instance of this.
+    class AotRegistration
+    {
+    public:
+        explicit AotRegistration(const AotProgram& program);
+    };
+
+    // The parts of Chip8Context that generated code is allowed to touch.
+    class AotRuntime
+    {
+    public:
+        static auto& registers(Chip8Context& context)
+        {
+            return context.m_registers;
+        }
+
+        // Runs the instruction at PC through the interpreter's handlers and
+        // returns 1, or 0 if it stopped run() without executing (waiting for
+        // a key, a trapped stack fault or an idle loop).
+        static std::uint64_t interpret(Chip8Context& context)
+        {
+            return context.executeTable(1);
+        }
+
+        // Whether an interpreted instruction asked for run() to stop.
+        static bool stopped(const Chip8Context& context)
+        {
+            return context.m_stopReason != StopReason::BudgetExhausted;
+        }
+
+        static bool isKeyPressed(const Chip8Context& context, std::uint8_t key)
+        {
+            return context.isKeyPressed(key);
+        }
+
+        static void drawSprite(Chip8Context& context, std::uint8_t x, std::uint8_t y, std::uint8_t rows)
+        {
+            context.drawSprite(x, y, rows);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,396 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "format.h"
+#include "chip8.h"
+#include "cli.h"
+
+// Runs every job in a manifest on a pool of worker threads, each job in a
+// context of its own, and writes one result per job as CSV or JSON.
+//
+// The manifest has one job per line, fields separated by commas, with blank
+// lines and lines starting with # ignored:
+//
+//   rom, seed, frames, cycles per frame, input script
+//
+// Everything after the ROM path is optional, defaulting to seed 0 and the
+// --frames and --cycles given on the command line. The input script is a
+// space separated list of frame:keys entries in increasing frame order,
+// each holding the keypad state keys (a hex mask, bit n for key n) from the
+// start of that frame on. For example "0:0 30:20 32:0" taps key 5 for two
+// frames half a second in.
+
+static const std::uint64_t CYCLES_PER_FRAME = chip8::DEFAULT_CYCLES_PER_FRAME;
+static const std::uint64_t FRAMES = 600;
+
+enum class Format
+{
+    Csv,
+    Json,
+};
+
+struct Options
+{
+    const char* manifestPath = nullptr;
+    const char* outputPath = nullptr;
+    std::uint64_t cyclesPerFrame = CYCLES_PER_FRAME;
+    std::uint64_t frames = FRAMES;
+    chip8::Core core = chip8::Core::Table;
+    chip8::StackPolicy stackPolicy = chip8::StackPolicy::Trap;
+    unsigned workers = 0;
+    Format format = Format::Csv;
+};
+
+struct InputEvent
+{
+    std::uint64_t frame;
+    std::uint16_t keys;
+};
+
+struct Job
+{
+    std::string romPath;
+    const std::vector<std::uint8_t>* rom = nullptr;
+    std::uint32_t seed = 0;
+    std::uint64_t frames = 0;
+    std::uint64_t cyclesPerFrame = 0;
+    std::vector<InputEvent> input;
+};
+
+struct Result
+{
+    chip8::StopReason reason = chip8::StopReason::BudgetExhausted;
+    std::uint64_t frames = 0;
+    std::uint64_t cycles = 0;
+    std::uint64_t idleCycles = 0;
+    std::uint64_t framebufferHash = 0;
+    std::uint16_t pc = 0;
+    std::uint16_t i = 0;
+    std::uint8_t delayTimer = 0;
+    std::uint8_t soundTimer = 0;
+    double seconds = 0;
+};
+
+static bool parseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (std::strcmp(arg, "--cycles") == 0 && hasValue) {
+            options.cyclesPerFrame = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(arg, "--frames") == 0 && hasValue) {
+            options.frames = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(arg, "--core") == 0 && hasValue) {
+            if (!chip8::parseCore(argv[++i], options.core)) {
+                return false;
+            }
+        } else if (std::strcmp(arg, "--stack") == 0 && hasValue) {
+            if (!chip8::parseStackPolicy(argv[++i], options.stackPolicy)) {
+                return false;
+            }
+        } else if (std::strcmp(arg, "--workers") == 0 && hasValue) {
+            options.workers = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 0));
+        } else if (std::strcmp(arg, "--json") == 0) {
+            options.format = Format::Json;
+        } else if (std::strcmp(arg, "--output") == 0 && hasValue) {
+            options.outputPath = argv[++i];
+        } else if (arg[0] != '-' && !options.manifestPath) {
+            options.manifestPath = arg;
+        } else {
+            return false;
+        }
+    }
+
+    return options.manifestPath != nullptr && options.cyclesPerFrame > 0;
+}
+
+static std::string trim(const std::string& text)
+{
+    const auto first = text.find_first_not_of(" \t\r");
+    if (first == std::string::npos) {
+        return {};
+    }
+
+    return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+}
+
+static bool parseNumber(const std::string& text, std::uint64_t& value, int base = 0)
+{
+    if (text.empty()) {
+        return false;
+    }
+
+    char* end;
+    value = std::strtoull(text.c_str(), &end, base);
+
+    return *end == '\0';
+}
+
+static bool parseInput(const std::string& script, std::vector<InputEvent>& input)
+{
+    std::istringstream entries(script);
+    std::string entry;
+
+    while (entries >> entry) {
+        const auto colon = entry.find(':');
+        std::uint64_t frame;
+        std::uint64_t keys;
+
+        if (colon == std::string::npos ||
+            !parseNumber(entry.substr(0, colon), frame, 10) ||
+            !parseNumber(entry.substr(colon + 1), keys, 16) ||
+            keys > 0xFFFF ||
+            (!input.empty() && frame < input.back().frame)) {
+            return false;
+        }
+
+        input.push_back({ frame, static_cast<std::uint16_t>(keys) });
+    }
+
+    return true;
+}
+
+// Reads the manifest into jobs, loading each ROM once however many jobs
+// use it. Reports the first problem found and returns false.
+static bool loadManifest(const Options& options, std::vector<Job>& jobs,
+                         std::map<std::string, std::vector<std::uint8_t>>& roms)
+{
+    std::ifstream manifest(options.manifestPath);
+    if (!manifest) {
+        fmt::print(stderr, "Couldn't open manifest {}\n", options.manifestPath);
+        return false;
+    }
+
+    std::string line;
+
+    for (std::size_t number = 1; std::getline(manifest, line); number++) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::vector<std::string> fields;
+        std::istringstream stream(line);
+        std::string field;
+
+        while (std::getline(stream, field, ',')) {
+            fields.push_back(trim(field));
+        }
+
+        Job job;
+        job.romPath = fields[0];
+        job.frames = options.frames;
+        job.cyclesPerFrame = options.cyclesPerFrame;
+
+        std::uint64_t value;
+        bool valid = fields.size() <= 5 && !job.romPath.empty();
+
+        if (valid && fields.size() > 1 && !fields[1].empty()) {
+            valid = parseNumber(fields[1], value) && value <= 0xFFFFFFFF;
+            job.seed = static_cast<std::uint32_t>(value);
+        }
+
+        if (valid && fields.size() > 2 && !fields[2].empty()) {
+            valid = parseNumber(fields[2], job.frames);
+        }
+
+        if (valid && fields.size() > 3 && !fields[3].empty()) {
+            valid = parseNumber(fields[3], job.cyclesPerFrame) && job.cyclesPerFrame > 0;
+        }
+
+        if (valid && fields.size() > 4) {
+            valid = parseInput(fields[4], job.input);
+        }
+
+        if (!valid) {
+            fmt::print(stderr, "{}:{}: malformed job\n", options.manifestPath, number);
+            return false;
+        }
+
+        auto rom = roms.find(job.romPath);
+        if (rom == roms.end()) {
+            rom = roms.emplace(job.romPath, std::vector<std::uint8_t>()).first;
+
+            if (!chip8::readFile(job.romPath, rom->second)) {
+                fmt::print(stderr, "{}:{}: couldn't load ROM {}\n", options.manifestPath, number, job.romPath);
+                return false;
+            }
+        }
+
+        job.rom = &rom->second;
+        jobs.push_back(std::move(job));
+    }
+
+    return true;
+}
+
+static bool isFailure(chip8::StopReason reason)
+{
+    return reason == chip8::StopReason::UnknownOpcode || reason == chip8::StopReason::StackFault;
+}
+
+static void runJob(const Job& job, const Options& options, Result& result)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    auto context = std::make_unique<chip8::Chip8Context>();
+    context->loadROM(*job.rom);
+    context->setCore(options.core);
+    context->setStackPolicy(options.stackPolicy);
+    context->seedRandom(job.seed);
+
+    auto input = job.input.cbegin();
+
+    while (result.frames < job.frames) {
+        for (; input != job.input.cend() && input->frame <= result.frames; ++input) {
+            context->setKeys(input->keys);
+        }
+
+        result.reason = context->runFrame(job.cyclesPerFrame);
+        result.frames++;
+
+        if (isFailure(result.reason)) {
+            break;
+        }
+    }
+
+    result.cycles = context->getCycles();
+    result.idleCycles = context->getIdleCycles();
+    result.framebufferHash = chip8::hashFramebuffer(context->getFramebufferRows());
+    result.pc = context->getPC();
+    result.i = context->getI();
+    result.delayTimer = context->getDelayTimer();
+    result.soundTimer = context->getSoundTimer();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    result.seconds = elapsed.count();
+}
+
+static void writeResults(std::FILE* out, Format format, const std::vector<Job>& jobs,
+                         const std::vector<Result>& results)
+{
+    if (format == Format::Csv) {
+        fmt::print(out, "job,rom,seed,status,frames,instructions,idle,framebuffer,pc,i,dt,st,seconds\n");
+    } else {
+        fmt::print(out, "[\n");
+    }
+
+    for (std::size_t index = 0; index < jobs.size(); index++) {
+        const auto& job = jobs[index];
+        const auto& result = results[index];
+
+        if (format == Format::Csv) {
+            fmt::print(out, "{},{},{},{},{},{},{},{:016x},{},{},{},{},{:.6f}\n",
+                       index, chip8::quoteCsv(job.romPath), job.seed, chip8::getStopReasonName(result.reason),
+                       result.frames, result.cycles, result.idleCycles, result.framebufferHash, result.pc, result.i,
+                       result.delayTimer, result.soundTimer, result.seconds);
+        } else {
+            fmt::print(out, "  {{\"job\": {}, \"rom\": {}, \"seed\": {}, \"status\": \"{}\", \"frames\": {}, "
+                       "\"instructions\": {}, \"idle\": {}, \"framebuffer\": \"{:016x}\", \"pc\": {}, \"i\": {}, "
+                       "\"dt\": {}, \"st\": {}, \"seconds\": {:.6f}}}{}\n",
+                       index, chip8::quoteJson(job.romPath), job.seed, chip8::getStopReasonName(result.reason),
+                       result.frames, result.cycles, result.idleCycles, result.framebufferHash, result.pc, result.i,
+                       result.delayTimer, result.soundTimer, result.seconds,
+                       index + 1 < jobs.size() ? "," : "");
+        }
+    }
+
+    if (format == Format::Json) {
+        fmt::print(out, "]\n");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        fmt::print("Usage: {} [options] <manifest>\n"
+                   "  --cycles N   default instructions per 60 Hz frame (default {})\n"
+                   "  --frames N   default frames per job (default {})\n"
+                   "  --core C     table, threaded, jit or aot (default table)\n"
+                   "  --stack P    stack overflow policy: wrap, trap or abort (default trap)\n"
+                   "  --workers N  worker threads (default one per hardware thread)\n"
+                   "  --json       write results as JSON instead of CSV\n"
+                   "  --output F   write results to F instead of standard output\n",
+                   argv[0], CYCLES_PER_FRAME, FRAMES);
+        return 1;
+    }
+
+    std::vector<Job> jobs;
+    std::map<std::string, std::vector<std::uint8_t>> roms;
+
+    if (!loadManifest(options, jobs, roms)) {
+        return 1;
+    }
+
+    auto workers = options.workers ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+    workers = static_cast<unsigned>(std::min<std::size_t>(workers, std::max<std::size_t>(jobs.size(), 1)));
+
+    // Jobs are handed out one at a time from a shared counter, so a few long
+    // ones don't hold up a worker's whole share. Each result has its own
+    // slot, and nothing else is shared.
+    std::vector<Result> results(jobs.size());
+    std::atomic<std::size_t> next{ 0 };
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> pool;
+    for (unsigned worker = 0; worker < workers; worker++) {
+        pool.emplace_back([&]() {
+            for (auto index = next++; index < jobs.size(); index = next++) {
+                runJob(jobs[index], options, results[index]);
+            }
+        });
+    }
+
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::FILE* out = stdout;
+    if (options.outputPath) {
+        out = std::fopen(options.outputPath, "w");
+        if (!out) {
+            fmt::print(stderr, "Couldn't open {} for writing\n", options.outputPath);
+            return 1;
+        }
+    }
+
+    writeResults(out, options.format, jobs, results);
+
+    if (out != stdout) {
+        std::fclose(out);
+    }
+
+    std::uint64_t cycles = 0;
+    std::uint64_t frames = 0;
+    std::size_t failed = 0;
+
+    for (const auto& result : results) {
+        cycles += result.cycles;
+        frames += result.frames;
+        failed += isFailure(result.reason);
+    }
+
+    fmt::print(stderr, "{} jobs ({} failed) on {} workers in {:.3f} s: "
+               "{:.1f} jobs/s, {:.0f} frames/s, {:.1f} MIPS\n",
+               jobs.size(), failed, workers, elapsed.count(), jobs.size() / elapsed.count(),
+               frames / elapsed.count(), cycles / elapsed.count() / 1e6);
+
+    return failed ? 2 : 0;
+}
@@ -3,11 +3,13 @@
 #include <cassert>
 #include <cstdint>
 #include <cstdlib>
-#include <chrono>
+#include <cstring>
 #include <optional>
 
+#include "aot.h"
 #include "chip8.h"
 #include "format.h"
+#include "jit.h"
 
 namespace
 {
@@ -23,201 +25,915 @@ namespace
         SUBN,
         SHL = 0xE
     };
+
+    chip8::InstructionKind classify(std::uint16_t raw)
+    {
+        using Kind = chip8::InstructionKind;
+
+        switch ((raw & 0xF000) >> 12) {
+        case 0x0:
+            if (raw == 0x00E0) {
+                return Kind::CLS;
+            } else if (raw == 0x00EE) {
+                return Kind::RET;
+            }
+            break;
+
+        case 0x1: return Kind::JP;
+        case 0x2: return Kind::CALL;
+        case 0x3: return Kind::SE;
+        case 0x4: return Kind::SNE;
+        case 0x6: return Kind::LD;
+        case 0x7: return Kind::ADD;
+
+        case 0x8:
+            switch (raw & 0x000F) {
+            case SubOp8::LD:   return Kind::LD_VV;
+            case SubOp8::OR:   return Kind::OR;
+            case SubOp8::AND:  return Kind::AND;
+            case SubOp8::XOR:  return Kind::XOR;
+            case SubOp8::ADD:  return Kind::ADD_VV;
+            case SubOp8::SUB:  return Kind::SUB;
+            case SubOp8::SHR:  return Kind::SHR;
+            case SubOp8::SUBN: return Kind::SUBN;
+            case SubOp8::SHL:  return Kind::SHL;
+            }
+            break;
+
+        case 0xA: return Kind::LDI;
+        case 0xC: return Kind::RND;
+        case 0xD: return Kind::DRW;
+
+        case 0xE:
+            switch (raw & 0xF0FF) {
+            case 0xE09E: return Kind::SKP;
+            case 0xE0A1: return Kind::SKNP;
+            }
+            break;
+
+        case 0xF:
+            switch (raw & 0xF0FF) {
+            case 0xF007: return Kind::LD_V_DT;
+            case 0xF00A: return Kind::LD_V_K;
+            case 0xF015: return Kind::LD_DT_V;
+            case 0xF018: return Kind::LD_ST_V;
+            case 0xF01E: return Kind::ADD_I_V;
+            }
+            break;
+        }
+
+        return Kind::Unknown;
+    }
+
+    chip8::FramebufferRow rotateRight(chip8::FramebufferRow value, unsigned count)
+    {
+        const unsigned bits = sizeof(value) * 8;
+        return (value >> count) | (value << ((bits - count) % bits));
+    }
 }
 
 namespace chip8
 {
-    const std::array<Chip8Context::InstructionHandler, 16> Chip8Context::instructionHandlers = {{
+    const std::array<Chip8Context::InstructionHandler, 18> Chip8Context::instructionHandlers = {{
         &Chip8Context::handle0,
         &Chip8Context::handleJP,
         &Chip8Context::handleCALL,
         &Chip8Context::handleSE,
         &Chip8Context::handleSNE,
-        nullptr,
+        &Chip8Context::handleUnknown,
         &Chip8Context::handleLD,
         &Chip8Context::handleADD,
         &Chip8Context::handle8,
-        nullptr,
+        &Chip8Context::handleUnknown,
         &Chip8Context::handleLDI,
-        nullptr,
+        &Chip8Context::handleUnknown,
         &Chip8Context::handleRND,
         &Chip8Context::handleDRW,
-        nullptr,
+        &Chip8Context::handleE,
         &Chip8Context::handleF,
+        &Chip8Context::handleBreakpoint,
+        &Chip8Context::handleIdleLoop,
     }};
 
+    std::uint64_t hashFramebuffer(const Framebuffer& framebuffer)
+    {
+        std::uint64_t hash = 0xCBF29CE484222325;
+
+        for (auto row : framebuffer) {
+            for (std::size_t i = 0; i < sizeof(row); i++) {
+                hash = (hash ^ ((row >> (i * 8)) & 0xFF)) * 0x100000001B3;
+            }
+        }
+
+        return hash;
+    }
+
+    Chip8Context::Chip8Context()
+    {
+        // Blank memory decodes the same whatever the settings, as there are
+        // no breakpoints yet and no idle loops in it.
+        m_pages.fill(getBlankPage());
+        m_decoded = getBlankDecodeCache();
+    }
+
+    Chip8Context::~Chip8Context() = default;
+
+    const std::shared_ptr<Chip8Context::MemoryPage>& Chip8Context::getBlankPage()
+    {
+        static const auto page = std::make_shared<MemoryPage>(MemoryPage{{ 0 }});
+        return page;
+    }
+
+    const std::shared_ptr<Chip8Context::DecodeCache>& Chip8Context::getBlankDecodeCache()
+    {
+        static const auto cache = []() {
+            auto blank = std::make_shared<DecodeCache>();
+            blank->fill(decodeInstruction(0));
+            return blank;
+        }();
+
+        return cache;
+    }
+
+    void Chip8Context::fork(Chip8Context& child) const
+    {
+        if (&child == this) {
+            return;
+        }
+
+        child.m_registers = m_registers;
+        child.m_stack = m_stack;
+        child.m_SP = m_SP;
+        child.m_stackPolicy = m_stackPolicy;
+        child.m_pages = m_pages;
+        child.m_decoded = m_decoded;
+        child.m_ownedPages.reset();
+        child.m_ownsDecodeCache = false;
+        m_ownedPages.reset();
+        m_ownsDecodeCache = false;
+        child.m_framebuffer = m_framebuffer;
+        child.m_framebufferGeneration = m_framebufferGeneration;
+        child.m_dirtyRows = m_dirtyRows;
+        child.m_breakpoints = m_breakpoints;
+        child.m_keys = m_keys;
+        child.m_random = m_random;
+        child.m_cycles = m_cycles;
+        child.m_idleCycles = m_idleCycles;
+        child.m_skipIdleLoops = m_skipIdleLoops;
+        child.m_timerPeriod = m_timerPeriod;
+        child.m_timerCountdown = m_timerCountdown;
+        child.m_core = m_core;
+        child.m_aot = m_aot;
+        child.m_stopReason = m_stopReason;
+        child.m_resumeFromBreakpoint = m_resumeFromBreakpoint;
+#if CHIP8_PROFILE
+        child.m_profile = m_profile;
+#endif
+
+        // Whatever the child had compiled was for its old memory.
+        if (child.m_jit) {
+            child.m_jit->flush();
+        }
+    }
+
+    std::unique_ptr<Chip8Context> Chip8Context::fork() const
+    {
+        auto child = std::make_unique<Chip8Context>();
+        fork(*child);
+        return child;
+    }
+
+    std::size_t Chip8Context::getUnsharedMemoryBytes() const
+    {
+        std::size_t unshared = m_decoded.use_count() == 1 ? sizeof(DecodeCache) : 0;
+
+        for (const auto& page : m_pages) {
+            unshared += page.use_count() == 1 ? sizeof(MemoryPage) : 0;
+        }
+
+        return unshared;
+    }
+
+    Chip8Context::MemoryPage& Chip8Context::writablePage(std::size_t index)
+    {
+        auto& page = m_pages[index];
+
+        if (!m_ownedPages[index]) {
+            page = std::make_shared<MemoryPage>(*page);
+            m_ownedPages.set(index);
+        }
+
+        return *page;
+    }
+
+    Chip8Context::DecodeCache& Chip8Context::writableDecodeCache()
+    {
+        if (!m_ownsDecodeCache) {
+            m_decoded = std::make_shared<DecodeCache>(*m_decoded);
+            m_ownsDecodeCache = true;
+        }
+
+        return *m_decoded;
+    }
+
+    bool Chip8Context::copyToMemory(std::uint16_t address, const std::uint8_t* data, std::size_t size)
+    {
+        bool changed = false;
+
+        while (size > 0) {
+            const auto index = address / MEMORY_PAGE_SIZE;
+            const auto offset = address % MEMORY_PAGE_SIZE;
+            const auto count = std::min(size, MEMORY_PAGE_SIZE - offset);
+
+            if (std::memcmp(m_pages[index]->data() + offset, data, count) != 0) {
+                std::memcpy(writablePage(index).data() + offset, data, count);
+                changed = true;
+            }
+
+            address += count;
+            data += count;
+            size -= count;
+        }
+
+        return changed;
+    }
+
     void Chip8Context::loadROM(const std::vector<std::uint8_t>& buffer)
     {
         if (buffer.size() > ROM_MAX_SIZE) {
-            fmt::print("Warning: ROM size {} exceeds max size {}\n", buffer.size(), ROM_MAX_SIZE);
+            fmt::print(stderr, "Warning: ROM size {} exceeds max size {}\n", buffer.size(), ROM_MAX_SIZE);
         }
 
         auto num = std::min(buffer.size(), ROM_MAX_SIZE);
-        auto dest = m_memory.begin() + ROM_LOAD_ADDR;
 
-        std::copy_n(buffer.cbegin(), num, dest);
+        copyToMemory(ROM_LOAD_ADDR, buffer.data(), num);
+        predecode();
+
+        if (m_jit) {
+            m_jit->flush();
+        }
+
+        m_aot = findAotProgram(buffer);
     }
 
-    void Chip8Context::warnUnknownInstruction(std::uint16_t instruction)
+    Instruction decodeInstruction(std::uint16_t raw)
     {
-        fmt::print("W: Unknown instruction {:#04x} at {:#04x}\n", instruction, m_registers.PC);
+        Instruction instruction;
+        instruction.raw = raw;
+        instruction.nnn = raw & 0x0FFF;
+        instruction.op = (raw & 0xF000) >> 12;
+        instruction.kind = classify(raw);
+        instruction.x = (raw & 0x0F00) >> 8;
+        instruction.y = (raw & 0x00F0) >> 4;
+        instruction.n = raw & 0x000F;
+        instruction.nn = raw & 0x00FF;
+
+        return instruction;
     }
 
-    void Chip8Context::tick()
+    Instruction Chip8Context::decode(std::uint16_t address) const
     {
-        auto now = std::chrono::high_resolution_clock::now();
-        if (m_registers.DT > 0 && now - m_lastTick >= DELAY_TICK) {
-            m_registers.DT -= 1;
-            m_lastTick = now;
+        // The last byte of memory has no successor, so treat it as the high byte
+        // of an instruction whose low byte is zero rather than reading past the end.
+        std::uint16_t raw = readMemory(address) << 8;
+        if (address + 1u < MEMORY_SIZE) {
+            raw |= readMemory(address + 1);
         }
 
-        auto mem = m_memory.begin() + m_registers.PC;
-        std::uint16_t instruction = (*mem << 8) | *(mem + 1);
+        return decodeInstruction(raw);
+    }
 
-        auto op = (instruction & 0xF000) >> 12;
-        auto handler = instructionHandlers.at(op);
+    void Chip8Context::redecode(std::uint16_t address)
+    {
+        auto instruction = decode(address);
+        const auto read = [this](std::size_t at) { return readMemory(static_cast<std::uint16_t>(at)); };
+
+        if (m_breakpoints[address]) {
+            instruction.op = BREAKPOINT_HANDLER;
+            instruction.kind = Kind::Breakpoint;
+        } else if (m_skipIdleLoops && isIdleLoop(address, read)) {
+            instruction.op = IDLE_LOOP_HANDLER;
+            instruction.kind = Kind::IdleLoop;
+        }
 
-        std::optional<std::uint16_t> newPc;
+        // Leave the cache shared unless something really changed. The other
+        // fields all follow from raw.
+        const auto& current = getDecoded(address);
+        if (current.raw != instruction.raw || current.op != instruction.op || current.kind != instruction.kind) {
+            writableDecodeCache()[address] = instruction;
+        }
+    }
 
-        if (handler) {
-            newPc = (this->*instructionHandlers[op])(instruction);
-        } else {
-            warnUnknownInstruction(instruction);
+    void Chip8Context::predecode()
+    {
+        for (std::uint16_t address = 0; address < MEMORY_SIZE; address++) {
+            redecode(address);
         }
+    }
 
-        m_registers.PC = newPc.value_or(m_registers.PC + sizeof(instruction));
+    void Chip8Context::saveState(State& state) const
+    {
+        state.V = m_registers.V;
+        state.I = m_registers.I;
+        state.PC = m_registers.PC;
+        state.DT = m_registers.DT;
+        state.ST = m_registers.ST;
+        state.SP = m_SP;
+        state.keys = m_keys;
+        state.stack = m_stack;
+        state.random = m_random.getState();
+        state.cycles = m_cycles;
+        state.idleCycles = m_idleCycles;
+        state.timerCountdown = m_timerCountdown;
+        state.resumeFromBreakpoint = m_resumeFromBreakpoint;
+        state.framebuffer = m_framebuffer;
+
+        for (std::size_t index = 0; index < MEMORY_PAGE_COUNT; index++) {
+            std::memcpy(state.memory.data() + index * MEMORY_PAGE_SIZE, m_pages[index]->data(), MEMORY_PAGE_SIZE);
+        }
     }
 
-    std::optional<std::uint16_t> Chip8Context::handle0(std::uint16_t instruction)
+    bool Chip8Context::loadState(const State& state)
     {
-        if (instruction == 0x00E0) {
-            // CLS
-            m_framebuffer = {{ 0 }};
-        } else if (instruction == 0x00EE) {
-            // RET
-            assert(!m_stack.empty());
+        if (state.SP > STACK_SIZE) {
+            return false;
+        }
 
-            auto nextPc = m_stack.top();
-            m_stack.pop();
+        m_registers.V = state.V;
+        m_registers.I = state.I;
+        m_registers.PC = state.PC;
+        m_registers.DT = state.DT;
+        m_registers.ST = state.ST;
+        m_SP = state.SP;
+        m_keys = state.keys;
+        m_stack = state.stack;
+        m_random.setState(state.random);
+        m_cycles = state.cycles;
+        m_idleCycles = state.idleCycles;
+        m_timerCountdown = state.timerCountdown;
+        m_stopReason = StopReason::BudgetExhausted;
+        m_resumeFromBreakpoint = state.resumeFromBreakpoint != 0;
+
+        DirtyRows dirty = 0;
+        for (std::size_t y = 0; y < FRAMEBUFFER_HEIGHT; y++) {
+            if (m_framebuffer[y] != state.framebuffer[y]) {
+                m_framebuffer[y] = state.framebuffer[y];
+                dirty |= DirtyRows(1) << y;
+            }
+        }
 
-            return nextPc;
+        if (dirty != 0) {
+            m_dirtyRows |= dirty;
+            m_framebufferGeneration++;
+        }
+
+        if (copyToMemory(0, state.memory.data(), MEMORY_SIZE)) {
+            predecode();
+
+            if (m_jit) {
+                m_jit->flush();
+            }
+
+            // There's no telling whether this is still the image the
+            // translation was built from.
+            m_aot = nullptr;
+        }
+
+        return true;
+    }
+
+    void Chip8Context::setKey(std::uint8_t key, bool pressed)
+    {
+        const std::uint16_t mask = 1 << (key & 0xF);
+
+        if (pressed) {
+            m_keys |= mask;
         } else {
-            warnUnknownInstruction(instruction);
+            m_keys &= ~mask;
         }
+    }
 
-        return {};
+    void Chip8Context::setIdleLoopSkipping(bool enabled)
+    {
+        m_skipIdleLoops = enabled;
+        predecode();
+
+        if (m_jit) {
+            m_jit->flush();
+        }
+    }
+
+    void Chip8Context::setBreakpoint(std::uint16_t address)
+    {
+        address &= MEMORY_SIZE - 1;
+        m_breakpoints.set(address);
+        redecode(address);
+
+        if (m_jit) {
+            m_jit->invalidate(address);
+        }
+    }
+
+    void Chip8Context::clearBreakpoint(std::uint16_t address)
+    {
+        address &= MEMORY_SIZE - 1;
+        m_breakpoints.reset(address);
+        redecode(address);
+
+        if (m_jit) {
+            m_jit->invalidate(address);
+        }
     }
 
-    std::optional<std::uint16_t> Chip8Context::handleJP(std::uint16_t instruction)
+    void Chip8Context::reportUnknownInstruction(std::uint16_t instruction)
     {
-        return instruction & 0x0FFF;
+        fmt::print(stderr, "W: Unknown instruction {:#04x} at {:#04x}\n", instruction, m_registers.PC);
+        m_stopReason = StopReason::UnknownOpcode;
     }
 
-    std::optional<std::uint16_t> Chip8Context::handleCALL(std::uint16_t instruction)
+    bool Chip8Context::handleStackFault(std::uint16_t pc, bool overflow)
     {
-        assert(m_stack.size() < STACK_SIZE);
+        switch (m_stackPolicy) {
+        case StackPolicy::Wrap:
+            return true;
 
-        auto retAddr = m_registers.PC + sizeof(instruction);
-        m_stack.push(retAddr);
+        case StackPolicy::Trap:
+            m_stopReason = StopReason::StackFault;
+            return false;
 
-        return instruction & 0x0FFF;
+        case StackPolicy::Abort:
+            break;
+        }
+
+        fmt::print(stderr, "E: Stack {} at {:#04x}\n", overflow ? "overflow" : "underflow", pc);
+        std::abort();
     }
 
-    std::optional<std::uint16_t> Chip8Context::handleSE(std::uint16_t instruction)
+    void Chip8Context::setTimerPeriod(std::uint64_t period)
     {
-        auto reg = (instruction & 0x0F00) >> 8;
-        auto value = instruction & 0x00FF;
+        m_timerPeriod = period;
+        m_timerCountdown = period;
+    }
 
-        if (m_registers.V[reg] == value) {
-            return m_registers.PC + sizeof(instruction) * 2;
+    void Chip8Context::tickTimers()
+    {
+        if (m_registers.DT > 0) {
+            m_registers.DT -= 1;
+        }
+
+        if (m_registers.ST > 0) {
+            m_registers.ST -= 1;
+        }
+    }
+
+    void Chip8Context::advanceTimers(std::uint64_t executed)
+    {
+        if (m_timerPeriod == 0) {
+            return;
+        }
+
+        assert(executed <= m_timerCountdown);
+        m_timerCountdown -= executed;
+
+        if (m_timerCountdown == 0) {
+            tickTimers();
+            m_timerCountdown = m_timerPeriod;
+        }
+    }
+
+    std::uint64_t Chip8Context::skipIdleLoop(std::uint64_t budget)
+    {
+        const auto address = m_registers.PC & (MEMORY_SIZE - 1);
+        const auto load = decode(address);
+
+        // DT can't change before the next timer step, so every whole iteration
+        // until then does the same thing.
+        auto limit = budget;
+        if (m_timerPeriod != 0) {
+            limit = std::min(limit, m_timerCountdown);
+        }
+
+        bool breakpoints = false;
+        for (std::size_t i = 1; i <= IDLE_LOOP_LENGTH && address + i * INSTRUCTION_SIZE < MEMORY_SIZE; i++) {
+            breakpoints |= m_breakpoints[address + i * INSTRUCTION_SIZE];
+        }
+
+        const auto skipped = m_registers.DT != 0 && !breakpoints ? limit / IDLE_LOOP_LENGTH * IDLE_LOOP_LENGTH : 0;
+
+        if (skipped > 0) {
+            m_registers.V[load.x] = m_registers.DT;
+            m_idleCycles += skipped;
+            advanceTimers(skipped);
+            return skipped;
+        }
+
+        // The timer has run out, or there's less than an iteration left:
+        // execute the load for real and carry on from there.
+        executeInstruction(load);
+        advanceTimers(1);
+        return 1;
+    }
+
+    void Chip8Context::tick()
+    {
+        if (m_timerPeriod != 0) {
+            run(1);
+            return;
+        }
+
+        // The timers are otherwise only aged by runFrame(), which someone
+        // single stepping never calls.
+        const auto cycles = m_cycles;
+        run(1);
+
+        if (m_cycles != cycles && ++m_timerCountdown >= DEFAULT_CYCLES_PER_FRAME) {
+            m_timerCountdown = 0;
+            tickTimers();
+        }
+    }
+
+    StopReason Chip8Context::run(std::uint64_t count)
+    {
+        m_stopReason = StopReason::BudgetExhausted;
+        std::uint64_t executed = 0;
+
+        if (m_resumeFromBreakpoint && count > 0) {
+            // Step over the breakpoint we stopped on last time by running the
+            // unpatched instruction underneath it.
+            m_resumeFromBreakpoint = false;
+
+            if (m_breakpoints[m_registers.PC & (MEMORY_SIZE - 1)]) {
+                if (executeInstruction(decode(m_registers.PC & (MEMORY_SIZE - 1)))) {
+                    executed++;
+                    advanceTimers(1);
+                }
+            }
+        }
+
+        // With a timer period set, the cores run in slices that end exactly
+        // on a timer step so the guest sees DT change at the same instruction
+        // whichever core is selected.
+        while (executed < count && m_stopReason == StopReason::BudgetExhausted) {
+            auto slice = count - executed;
+            if (m_timerPeriod != 0) {
+                slice = std::min(slice, m_timerCountdown);
+            }
+
+            auto sliceExecuted = executeCore(slice);
+            executed += sliceExecuted;
+            advanceTimers(sliceExecuted);
+
+            if (m_stopReason == StopReason::IdleLoop) {
+                m_stopReason = StopReason::BudgetExhausted;
+                executed += skipIdleLoop(count - executed);
+            }
+        }
+
+        m_cycles += executed;
+        m_resumeFromBreakpoint = m_stopReason == StopReason::Breakpoint;
+
+        return m_stopReason;
+    }
+
+    StopReason Chip8Context::runFrame(std::uint64_t cyclesPerFrame)
+    {
+        auto reason = run(cyclesPerFrame);
+
+        if (m_timerPeriod == 0 && (reason == StopReason::BudgetExhausted || reason == StopReason::WaitForKey)) {
+            tickTimers();
+        }
+
+        return reason;
+    }
+
+    std::uint64_t Chip8Context::executeCore(std::uint64_t count)
+    {
+        switch (m_core) {
+        case Core::Table:
+            return executeTable(count);
+
+        case Core::Threaded:
+            return executeThreaded(count);
+
+        case Core::Jit:
+            return executeJit(count);
+
+        case Core::Aot:
+            return executeAot(count);
+        }
+
+        return 0;
+    }
+
+    std::uint64_t Chip8Context::executeAot(std::uint64_t count)
+    {
+        // Translations don't know about breakpoints, so let the interpreter
+        // handle those.
+        if (m_aot && m_breakpoints.none()) {
+            return m_aot->entry(*this, count);
+        }
+
+        return executeThreaded(count);
+    }
+
+    std::uint64_t Chip8Context::executeJit(std::uint64_t count)
+    {
+        if (!Jit::isSupported()) {
+            return executeThreaded(count);
+        }
+
+        if (!m_jit) {
+            m_jit = std::make_unique<Jit>();
+        }
+
+        if (!m_jit->isAvailable()) {
+            return executeThreaded(count);
+        }
+
+        std::uint64_t executed = 0;
+
+        while (executed < count && m_stopReason == StopReason::BudgetExhausted) {
+            auto blockExecuted = m_jit->execute(*this, count - executed);
+
+            if (blockExecuted == 0) {
+                // Not compilable (or the block doesn't fit in what's left of
+                // the budget), so run just this instruction through the handlers.
+                blockExecuted = executeTable(1);
+                m_jit->countInterpreted(blockExecuted);
+            }
+
+            executed += blockExecuted;
+        }
+
+        return executed;
+    }
+
+    bool Chip8Context::executeInstruction(const Instruction& instruction)
+    {
+        const auto pc = m_registers.PC;
+        auto newPc = (this->*instructionHandlers[instruction.op])(instruction);
+        m_registers.PC = newPc.value_or(pc + INSTRUCTION_SIZE);
+
+        // Waiting for a key, breakpoints, stack faults and idle loops leave PC
+        // where it was without executing anything.
+        const bool executed = m_stopReason != StopReason::WaitForKey && m_stopReason != StopReason::Breakpoint &&
+                              m_stopReason != StopReason::StackFault && m_stopReason != StopReason::IdleLoop;
+
+        if (executed) {
+            countInstruction(pc, instruction.kind);
+        }
+
+        return executed;
+    }
+
+    std::uint64_t Chip8Context::executeTable(std::uint64_t count)
+    {
+        std::uint64_t executed = 0;
+
+        while (executed < count && m_stopReason == StopReason::BudgetExhausted) {
+            if (executeInstruction(getDecoded(m_registers.PC))) {
+                executed++;
+            }
+        }
+
+        return executed;
+    }
+
+    std::optional<std::uint16_t> Chip8Context::handleUnknown(const Instruction& instruction)
+    {
+        reportUnknownInstruction(instruction.raw);
+        return {};
+    }
+
+    std::optional<std::uint16_t> Chip8Context::handleBreakpoint(const Instruction&)
+    {
+        m_stopReason = StopReason::Breakpoint;
+        return m_registers.PC;
+    }
+
+    std::optional<std::uint16_t> Chip8Context::handleIdleLoop(const Instruction&)
+    {
+        m_stopReason = StopReason::IdleLoop;
+        return m_registers.PC;
+    }
+
+    std::optional<std::uint16_t> Chip8Context::handle0(const Instruction& instruction)
+    {
+        if (instruction.raw == 0x00E0) {
+            // CLS
+            clearScreen();
+        } else if (instruction.raw == 0x00EE) {
+            // RET
+            std::uint16_t nextPc;
+            if (!popReturnAddress(m_registers.PC, nextPc)) {
+                return m_registers.PC;
+            }
+
+            return nextPc;
+        } else {
+            reportUnknownInstruction(instruction.raw);
         }
 
         return {};
     }
 
-    std::optional<std::uint16_t> Chip8Context::handleSNE(std::uint16_t instruction)
+    std::optional<std::uint16_t> Chip8Context::handleJP(const Instruction& instruction)
     {
-        auto reg = (instruction & 0x0F00) >> 8;
-        auto value = instruction & 0x00FF;
+        return instruction.nnn;
+    }
 
-        if (m_registers.V[reg] != value) {
-            return m_registers.PC + sizeof(instruction) * 2;
+    std::optional<std::uint16_t> Chip8Context::handleCALL(const Instruction& instruction)
+    {
+        if (!pushReturnAddress(m_registers.PC, m_registers.PC + INSTRUCTION_SIZE)) {
+            return m_registers.PC;
+        }
+
+        return instruction.nnn;
+    }
+
+    std::optional<std::uint16_t> Chip8Context::handleSE(const Instruction& instruction)
+    {
+        if (m_registers.V[instruction.x] == instruction.nn) {
+            return m_registers.PC + INSTRUCTION_SIZE * 2;
         }
 
         return {};
     }
 
-    std::optional<std::uint16_t> Chip8Context::handleRND(std::uint16_t instruction)
+    std::optional<std::uint16_t> Chip8Context::handleSNE(const Instruction& instruction)
     {
-        auto reg = (instruction & 0x0F00) >> 8;
-        auto value = instruction & 0x00FF;
+        if (m_registers.V[instruction.x] != instruction.nn) {
+            return m_registers.PC + INSTRUCTION_SIZE * 2;
+        }
 
-        m_registers.V[reg] = std::rand() & value;
+        return {};
+    }
+
+    std::optional<std::uint16_t> Chip8Context::handleRND(const Instruction& instruction)
+    {
+        m_registers.V[instruction.x] = m_random.next() & instruction.nn;
 
         return {};
     }
 
-    std::optional<std::uint16_t> Chip8Context::handleDRW(std::uint16_t instruction)
+    std::optional<std::uint16_t> Chip8Context::handleDRW(const Instruction& instruction)
     {
-        const auto x = m_registers.V.at((instruction & 0x0F00) >> 8);
-        const auto y = m_registers.V.at((instruction & 0x00F0) >> 4);
-        const auto rows = instruction & 0x000F;
+        drawSprite(m_registers.V[instruction.x], m_registers.V[instruction.y], instruction.n);
+        return {};
+    }
 
-        m_registers.V[0xF] = 0;
+    void Chip8Context::drawSprite(std::uint8_t x, std::uint8_t y, std::uint8_t rows)
+    {
+        // Each sprite row is rotated into place in its framebuffer row, which
+        // also takes care of wrapping around the right edge.
+        const auto shift = x % FRAMEBUFFER_WIDTH;
+        FramebufferRow collisions = 0;
+        DirtyRows dirty = 0;
 
         for (auto i = 0; i < rows; i++) {
-            auto sprite = m_memory.at(m_registers.I + i);
+            const FramebufferRow sprite = readMemory(m_registers.I + i);
+            const auto bits = rotateRight(sprite << (FRAMEBUFFER_WIDTH - 8), shift);
+            const auto py = (y + i) % FRAMEBUFFER_HEIGHT;
+            auto& row = m_framebuffer[py];
+
+#if CHIP8_PROFILE
+            m_profile.collidingRows += (row & bits) != 0;
+#endif
+
+            collisions |= row & bits;
+            row ^= bits;
+
+            if (bits != 0) {
+                dirty |= DirtyRows(1) << py;
+            }
+        }
+
+        m_registers.V[0xF] = collisions != 0 ? 1 : 0;
+
+        if (dirty != 0) {
+            m_dirtyRows |= dirty;
+            m_framebufferGeneration++;
+        }
+
+#if CHIP8_PROFILE
+        m_profile.spriteHeights[rows & 0xF]++;
+        m_profile.collisions += collisions != 0;
+        m_profile.wrappedSprites += shift > FRAMEBUFFER_WIDTH - 8 || y % FRAMEBUFFER_HEIGHT + rows > FRAMEBUFFER_HEIGHT;
+#endif
+    }
+
+    const Profile& Chip8Context::getProfile() const
+    {
+#if CHIP8_PROFILE
+        return m_profile;
+#else
+        static const Profile empty;
+        return empty;
+#endif
+    }
 
-            for (auto j = 7; j >= 0; j--) {
-                const auto px = (x + j) % FRAMEBUFFER_WIDTH;
-                const auto py = (y + i) % FRAMEBUFFER_HEIGHT;
-                const auto offset = py * FRAMEBUFFER_WIDTH + px;
-                const std::uint8_t oldPixel = m_framebuffer.at(offset);
+    void Chip8Context::resetProfile()
+    {
+#if CHIP8_PROFILE
+        m_profile = Profile();
+#endif
+    }
 
-                m_framebuffer.at(offset) ^= 0x00 - (sprite & 1);
-                if (oldPixel == 0xFF && m_framebuffer.at(offset) == 0x00) {
-                    m_registers.V[0xF] = 1;
-                } 
+    void Chip8Context::clearScreen()
+    {
+        DirtyRows dirty = 0;
 
-                sprite >>= 1;
+        for (std::size_t y = 0; y < FRAMEBUFFER_HEIGHT; y++) {
+            if (m_framebuffer[y] != 0) {
+                m_framebuffer[y] = 0;
+                dirty |= DirtyRows(1) << y;
             }
         }
 
+        if (dirty != 0) {
+            m_dirtyRows |= dirty;
+            m_framebufferGeneration++;
+        }
+    }
+
+    std::array<std::uint8_t, FRAMEBUFFER_SIZE> Chip8Context::getFramebuffer() const
+    {
+        std::array<std::uint8_t, FRAMEBUFFER_SIZE> pixels;
+
+        for (std::size_t y = 0; y < FRAMEBUFFER_HEIGHT; y++) {
+            auto row = m_framebuffer[y];
+
+            for (std::size_t x = 0; x < FRAMEBUFFER_WIDTH; x++) {
+                pixels[y * FRAMEBUFFER_WIDTH + x] = (row >> (FRAMEBUFFER_WIDTH - 1)) ? 0xFF : 0x00;
+                row <<= 1;
+            }
+        }
+
+        return pixels;
+    }
+
+    std::optional<std::uint16_t> Chip8Context::handleLDI(const Instruction& instruction)
+    {
+        m_registers.I = instruction.nnn;
         return {};
     }
 
-    std::optional<std::uint16_t> Chip8Context::handleLDI(std::uint16_t instruction)
+    std::optional<std::uint16_t> Chip8Context::handleLD(const Instruction& instruction)
     {
-        m_registers.I = instruction & 0x0FFF;
+        m_registers.V[instruction.x] = instruction.nn;
+
         return {};
     }
 
-    std::optional<std::uint16_t> Chip8Context::handleLD(std::uint16_t instruction)
+    std::optional<std::uint16_t> Chip8Context::handleADD(const Instruction& instruction)
     {
-        auto reg = (instruction & 0x0F00) >> 8;
-        m_registers.V[reg] = instruction & 0x00FF;
+        m_registers.V[instruction.x] += instruction.nn;
 
         return {};
     }
 
-    std::optional<std::uint16_t> Chip8Context::handleADD(std::uint16_t instruction)
+    std::optional<std::uint16_t> Chip8Context::handleE(const Instruction& instruction)
     {
-        auto reg = (instruction & 0x0F00) >> 8;
-        m_registers.V[reg] += instruction & 0x00FF;
+        const bool pressed = isKeyPressed(m_registers.V[instruction.x]);
+
+        switch (instruction.raw & 0xF0FF) {
+        case 0xE09E:
+            // SKP Vx
+            if (pressed) {
+                return m_registers.PC + INSTRUCTION_SIZE * 2;
+            }
+            break;
+
+        case 0xE0A1:
+            // SKNP Vx
+            if (!pressed) {
+                return m_registers.PC + INSTRUCTION_SIZE * 2;
+            }
+            break;
+
+        default:
+            reportUnknownInstruction(instruction.raw);
+            break;
+        }
 
         return {};
     }
 
-    std::optional<std::uint16_t> Chip8Context::handleF(std::uint16_t instruction)
+    std::optional<std::uint16_t> Chip8Context::handleF(const Instruction& instruction)
     {
-        auto reg = (instruction & 0x0F00) >> 8;
+        auto reg = instruction.x;
 
-        switch (instruction & 0xF0FF) {
+        switch (instruction.raw & 0xF0FF) {
         case 0xF015:
             // LD DT, Vx
             m_registers.DT = m_registers.V[reg];
             break;
 
+        case 0xF018:
+            // LD ST, Vx
+            m_registers.ST = m_registers.V[reg];
+            break;
+
         case 0xF01E:
             // ADD I, Vx
             m_registers.I += m_registers.V[reg];
@@ -228,19 +944,33 @@ namespace chip8
             m_registers.V[reg] = m_registers.DT;
             break;
 
+        case 0xF00A:
+            // LD Vx, K
+            if (m_keys == 0) {
+                m_stopReason = StopReason::WaitForKey;
+                return m_registers.PC;
+            }
+
+            // Take the lowest numbered key that's held down.
+            m_registers.V[reg] = 0;
+            while (!isKeyPressed(m_registers.V[reg])) {
+                m_registers.V[reg]++;
+            }
+            break;
+
         default:
-            warnUnknownInstruction(instruction);
+            reportUnknownInstruction(instruction.raw);
             break;
         }
 
         return {};
     }
 
-    std::optional<std::uint16_t> Chip8Context::handle8(std::uint16_t instruction)
+    std::optional<std::uint16_t> Chip8Context::handle8(const Instruction& instruction)
     {
-        auto regA = (instruction & 0x0F00) >> 8;
-        auto regB = (instruction & 0x00F0) >> 4;
-        auto subOp = instruction & 0x000F;
+        auto regA = instruction.x;
+        auto regB = instruction.y;
+        auto subOp = instruction.n;
 
         switch (subOp) {
         case SubOp8::LD:  m_registers.V[regA]  = m_registers.V[regB]; break;
@@ -276,8 +1006,10 @@ namespace chip8
             break;
 
         default:
-            warnUnknownInstruction(instruction);
+            reportUnknownInstruction(instruction.raw);
             break;
         }
+
+        return {};
     }
 }
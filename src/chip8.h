@@ -2,18 +2,33 @@
 #define CHIP8_H
 
 #include <array>
-#include <chrono>
+#include <bitset>
 #include <cstdint>
+#include <memory>
 #include <optional>
-#include <stack>
+#include <type_traits>
 #include <vector>
 
+// Build everything with -DCHIP8_PROFILE=1 (make PROFILE=1) to have contexts
+// count what they execute, see Profile. It changes the layout of
+// Chip8Context, so it has to be the same for every file in a build.
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 0
+#endif
+
 namespace chip8
 {
     const std::size_t MEMORY_SIZE = 0x1000;
     const std::size_t STACK_SIZE = 16;
     const std::size_t NUM_GPRS = 16;
+    const std::size_t NUM_KEYS = 16;
     const std::uint16_t INITIAL_PC = 0x200;
+    const std::uint16_t INSTRUCTION_SIZE = 2;
+
+    // Contexts hold memory in pages, which forks share until one of them
+    // changes a page. See Chip8Context::fork().
+    const std::size_t MEMORY_PAGE_SIZE = 0x100;
+    const std::size_t MEMORY_PAGE_COUNT = MEMORY_SIZE / MEMORY_PAGE_SIZE;
 
     const std::size_t ROM_LOAD_ADDR = 0x200;
     const std::size_t ROM_MAX_SIZE = MEMORY_SIZE - ROM_LOAD_ADDR;
@@ -22,52 +37,699 @@ namespace chip8
     const std::size_t FRAMEBUFFER_HEIGHT = 32;
     const std::size_t FRAMEBUFFER_SIZE = FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT;
 
-    const std::chrono::milliseconds DELAY_TICK(16);
+    // The display is stored one bit per pixel, a word per row with the
+    // leftmost pixel in the most significant bit. A wider mode would only
+    // need a wider row type.
+    using FramebufferRow = std::uint64_t;
+    using Framebuffer = std::array<FramebufferRow, FRAMEBUFFER_HEIGHT>;
+
+    static_assert(sizeof(FramebufferRow) * 8 == FRAMEBUFFER_WIDTH, "A framebuffer row must hold exactly one line");
+
+    // Bit n set when row n of the framebuffer has changed.
+    using DirtyRows = std::uint32_t;
+
+    static_assert(sizeof(DirtyRows) * 8 >= FRAMEBUFFER_HEIGHT, "DirtyRows needs a bit per framebuffer row");
+
+    // FNV-1a over the framebuffer rows, for telling runs apart without
+    // keeping their framebuffers around.
+    std::uint64_t hashFramebuffer(const Framebuffer& framebuffer);
+
+    // Rate at which the delay and sound timers count down.
+    const unsigned TIMER_FREQUENCY = 60;
+
+    // Instructions per 60 Hz frame the front ends run by default, and how
+    // often tick() ages the timers when no timer period is set.
+    const std::uint64_t DEFAULT_CYCLES_PER_FRAME = 10;
+
+    // Interpreter cores. Table dispatches each instruction through the
+    // instructionHandlers member function table; Threaded runs the whole batch
+    // in a single function using computed goto (or a switch where the
+    // compiler doesn't support labels as values). Jit recompiles basic blocks
+    // to native code where the host supports it, see jit.h. Aot runs a ROM
+    // translated ahead of time by chip8-recompile, see aot.h; ROMs without a
+    // translation linked in use the threaded core.
+    enum class Core
+    {
+        Table,
+        Threaded,
+        Jit,
+        Aot,
+    };
+
+    // Every instruction the interpreter understands, used by the threaded
+    // core and the recompilers to dispatch without going through the coarse
+    // per-nibble handlers.
+    enum class InstructionKind : std::uint8_t
+    {
+        Unknown,
+        CLS,
+        RET,
+        JP,
+        CALL,
+        SE,
+        SNE,
+        LD,
+        ADD,
+        LD_VV,
+        OR,
+        AND,
+        XOR,
+        ADD_VV,
+        SUB,
+        SHR,
+        SUBN,
+        SHL,
+        LDI,
+        RND,
+        DRW,
+        LD_V_DT,
+        LD_DT_V,
+        LD_ST_V,
+        ADD_I_V,
+        SKP,
+        SKNP,
+        LD_V_K,
+        Breakpoint,
+        IdleLoop,
+
+        Count
+    };
+
+    // An instruction with its operand fields already extracted. The context
+    // keeps one of these for every address so tick() never has to fetch or
+    // decode.
+    struct Instruction
+    {
+        std::uint16_t raw;
+        std::uint16_t nnn;
+        std::uint8_t op;
+        InstructionKind kind;
+        std::uint8_t x;
+        std::uint8_t y;
+        std::uint8_t n;
+        std::uint8_t nn;
+    };
+
+    Instruction decodeInstruction(std::uint16_t raw);
+
+    // Instructions per iteration of a loop recognised by isIdleLoop().
+    const std::uint64_t IDLE_LOOP_LENGTH = 3;
+
+    // Whether the code at address busy waits on the delay timer, as either
+    //
+    //     LD Vx, DT          LD Vx, DT
+    //     SE Vx, 0           SNE Vx, 0
+    //     JP address         JP exit
+    //                        JP address
+    //
+    // While DT is nonzero an iteration of either only sets Vx to DT and ends
+    // up back at address. read(at) returns the byte of memory at at, for any
+    // at below MEMORY_SIZE.
+    template<typename Read>
+    bool isIdleLoop(std::uint16_t address, Read read)
+    {
+        auto fetch = [&](std::size_t index) {
+            const auto at = address + index * INSTRUCTION_SIZE;
+            return at + 1 < MEMORY_SIZE ? decodeInstruction(read(at) << 8 | read(at + 1)) : decodeInstruction(0);
+        };
+
+        const auto load = fetch(0);
+        if (load.kind != InstructionKind::LD_V_DT) {
+            return false;
+        }
+
+        const auto test = fetch(1);
+        if (test.x != load.x || test.nn != 0) {
+            return false;
+        }
+
+        if (test.kind == InstructionKind::SE) {
+            const auto loop = fetch(2);
+            return loop.kind == InstructionKind::JP && loop.nnn == address;
+        }
+
+        if (test.kind == InstructionKind::SNE) {
+            const auto exit = fetch(2);
+            const auto loop = fetch(3);
+            return exit.kind == InstructionKind::JP && loop.kind == InstructionKind::JP && loop.nnn == address;
+        }
+
+        return false;
+    }
+
+    // The same for MEMORY_SIZE bytes of memory in one piece.
+    inline bool isIdleLoop(std::uint16_t address, const std::uint8_t* memory)
+    {
+        return isIdleLoop(address, [memory](std::size_t at) { return memory[at]; });
+    }
+
+    // Why run() returned. BudgetExhausted means every requested instruction
+    // was executed; the others stop early with PC on the instruction that
+    // would run next.
+    enum class StopReason
+    {
+        BudgetExhausted,
+        WaitForKey,
+        UnknownOpcode,
+        Breakpoint,
+
+        // CALL with a full stack or RET with an empty one under
+        // StackPolicy::Trap. The instruction hasn't been executed.
+        StackFault,
+
+        // Only used inside run() to hand an idle loop over for fast-forwarding;
+        // never returned.
+        IdleLoop,
+    };
+
+    // What CALL does when all STACK_SIZE entries are in use and RET does when
+    // none are.
+    enum class StackPolicy
+    {
+        // The stack is a ring: an overflow overwrites the oldest return
+        // address and an underflow returns to the newest stale one.
+        Wrap,
+
+        // Stops run() with StopReason::StackFault, PC left on the offending
+        // instruction so it can be inspected.
+        Trap,
+
+        // Reports the fault and aborts the process, for test runs that
+        // should never hit one.
+        Abort,
+    };
+
+    // The generator behind RND: PCG32 (XSH-RR) with a fixed stream. Its
+    // whole state is one word, so it can be saved and restored with the rest
+    // of a context, and any seed is valid.
+    class Random
+    {
+    public:
+        explicit Random(std::uint32_t seed = 0)
+        {
+            this->seed(seed);
+        }
+
+        void seed(std::uint32_t seed)
+        {
+            m_state = 0;
+            next();
+            m_state += seed;
+            next();
+        }
+
+        std::uint32_t next()
+        {
+            const auto state = m_state;
+            m_state = state * MULTIPLIER + INCREMENT;
+
+            const auto xorshifted = static_cast<std::uint32_t>(((state >> 18) ^ state) >> 27);
+            const auto rotation = static_cast<unsigned>(state >> 59);
+
+            return (xorshifted >> rotation) | (xorshifted << ((32 - rotation) & 31));
+        }
+
+        std::uint64_t getState() const
+        {
+            return m_state;
+        }
+
+        void setState(std::uint64_t state)
+        {
+            m_state = state;
+        }
+
+    private:
+        static const std::uint64_t MULTIPLIER = 6364136223846793005;
+        static const std::uint64_t INCREMENT = 1442695040888963407;
+
+        std::uint64_t m_state;
+    };
+
+    // Everything that decides what a context does from here on, in one fixed
+    // size block with no pointers, so it can be copied with memcpy and kept
+    // in bulk for rewinding or searching. Host settings (core, breakpoints,
+    // idle loop skipping, timer period) aren't part of it. See state.h for
+    // the file format.
+    struct State
+    {
+        std::array<std::uint8_t, NUM_GPRS> V;
+        std::uint16_t I;
+        std::uint16_t PC;
+        std::uint8_t DT;
+        std::uint8_t ST;
+        std::uint8_t SP;
+        std::uint16_t keys;
+        std::array<std::uint16_t, STACK_SIZE> stack;
+        std::uint64_t random;
+        std::uint64_t cycles;
+        std::uint64_t idleCycles;
+        std::uint64_t timerCountdown;
+
+        // 1 if run() last stopped on a breakpoint, which the next run()
+        // steps over rather than stopping on again.
+        std::uint8_t resumeFromBreakpoint;
+
+        Framebuffer framebuffer;
+        std::array<std::uint8_t, MEMORY_SIZE> memory;
+    };
+
+    static_assert(std::is_trivially_copyable<State>::value, "State has to be copyable as plain bytes");
+
+    // Whether this build counts into a Profile.
+    const bool PROFILING = CHIP8_PROFILE != 0;
+
+    // What a context has executed, for finding what's worth optimising.
+    // Instructions are counted by the Table and Threaded cores; Jit and Aot
+    // only count the ones they hand to the interpreter. Sprites are counted
+    // whichever core draws them. See profile.h for writing one out.
+    struct Profile
+    {
+        // Instructions executed by kind, which is the opcode and for 0, 8, E
+        // and F the sub-op.
+        std::array<std::uint64_t, static_cast<std::size_t>(InstructionKind::Count)> kinds = {{ 0 }};
+
+        // Instructions executed at each address.
+        std::array<std::uint64_t, MEMORY_SIZE> addresses = {{ 0 }};
+
+        // DRW: sprites drawn by height, how many set VF, the rows in them
+        // that hit lit pixels, and how many wrapped around an edge.
+        std::array<std::uint64_t, 16> spriteHeights = {{ 0 }};
+        std::uint64_t collisions = 0;
+        std::uint64_t collidingRows = 0;
+        std::uint64_t wrappedSprites = 0;
+    };
+
+    class Jit;
+    struct AotProgram;
 
     class Chip8Context
     {
     public:
-        const std::array<std::uint8_t, FRAMEBUFFER_SIZE>& getFramebuffer() const
+        Chip8Context();
+        ~Chip8Context();
+
+        // Makes child an exact copy of this context, settings included, that
+        // then runs on its own. Memory pages and the decode cache are shared
+        // copy-on-write, so a fork costs little more than the registers and
+        // framebuffer, and allocates nothing until one side changes memory
+        // (which the guest can't do; loading a ROM or a different state can)
+        // or its decoding (breakpoints, idle loop skipping). The JIT cache
+        // isn't shared: the child compiles its own if it runs the Jit core.
+        // Forks can run, and be changed, on other threads than their parent
+        // and each other; fork() itself needs the parent left alone while it
+        // copies.
+        void fork(Chip8Context& child) const;
+        std::unique_ptr<Chip8Context> fork() const;
+
+        // Size of the memory pages and decode cache held by no other context,
+        // which is what this one costs on top of sizeof(Chip8Context).
+        std::size_t getUnsharedMemoryBytes() const;
+
+        const Framebuffer& getFramebufferRows() const
         {
             return m_framebuffer;
         }
 
+        // The display expanded to a byte per pixel, 0xFF when lit and 0x00
+        // otherwise.
+        std::array<std::uint8_t, FRAMEBUFFER_SIZE> getFramebuffer() const;
+
+        // Bumped every time the contents of the framebuffer change.
+        std::uint64_t getFramebufferGeneration() const
+        {
+            return m_framebufferGeneration;
+        }
+
+        // Rows changed since the last clearDirtyRows().
+        DirtyRows getDirtyRows() const
+        {
+            return m_dirtyRows;
+        }
+
+        void clearDirtyRows()
+        {
+            m_dirtyRows = 0;
+        }
+
+        Core getCore() const
+        {
+            return m_core;
+        }
+
+        void setCore(Core core)
+        {
+            m_core = core;
+        }
+
+        // Null until the Jit core has run at least once.
+        const Jit* getJit() const
+        {
+            return m_jit.get();
+        }
+
+        // The ahead-of-time translation of the loaded ROM, or null if there
+        // isn't one or loadState() has replaced memory since it was loaded.
+        const AotProgram* getAotProgram() const
+        {
+            return m_aot;
+        }
+
+        // Total number of instructions executed since construction.
+        std::uint64_t getCycles() const
+        {
+            return m_cycles;
+        }
+
+        std::uint16_t getPC() const
+        {
+            return m_registers.PC;
+        }
+
+        std::uint16_t getI() const
+        {
+            return m_registers.I;
+        }
+
+        std::uint8_t getDelayTimer() const
+        {
+            return m_registers.DT;
+        }
+
+        // The buzzer sounds while this is nonzero.
+        std::uint8_t getSoundTimer() const
+        {
+            return m_registers.ST;
+        }
+
+        // How many of getCycles() were idle loop iterations skipped over
+        // rather than executed.
+        std::uint64_t getIdleCycles() const
+        {
+            return m_idleCycles;
+        }
+
+        // Zeros when not built with CHIP8_PROFILE.
+        const Profile& getProfile() const;
+        void resetProfile();
+
+        bool getIdleLoopSkipping() const
+        {
+            return m_skipIdleLoops;
+        }
+
+        // Fast-forwards loops that wait on the delay timer (see isIdleLoop())
+        // to the next point where DT can change: the next timer step with a
+        // timer period set, otherwise the end of the run() budget. Skipping
+        // is exact, so it only affects speed and getIdleCycles(). On by
+        // default.
+        void setIdleLoopSkipping(bool enabled);
+
+        std::uint64_t getTimerPeriod() const
+        {
+            return m_timerPeriod;
+        }
+
+        // Ages the timers by one step every period instructions, counted
+        // across run() calls. Zero (the default) leaves the timers to
+        // runFrame(), one step per frame, or to tick().
+        void setTimerPeriod(std::uint64_t period);
+
+        bool isKeyPressed(std::uint8_t key) const
+        {
+            return (m_keys >> (key & 0xF)) & 1;
+        }
+
+        // Keypad state as a bitmask, bit n set when key n is held.
+        std::uint16_t getKeys() const
+        {
+            return m_keys;
+        }
+
+        void setKeys(std::uint16_t keys)
+        {
+            m_keys = keys;
+        }
+
+        void setKey(std::uint8_t key, bool pressed);
+
+        StackPolicy getStackPolicy() const
+        {
+            return m_stackPolicy;
+        }
+
+        // Trap by default.
+        void setStackPolicy(StackPolicy policy)
+        {
+            m_stackPolicy = policy;
+        }
+
+        // Restarts the sequence RND draws from. Every context has its own
+        // generator, so instances running side by side never affect each
+        // other and a run is repeatable from its seed.
+        void seedRandom(std::uint32_t seed)
+        {
+            m_random.seed(seed);
+        }
+
+        // Where the RND sequence has got to. Restoring it later replays the
+        // same values from that point on.
+        std::uint64_t getRandomState() const
+        {
+            return m_random.getState();
+        }
+
+        void setRandomState(std::uint64_t state)
+        {
+            m_random.setState(state);
+        }
+
+        // Copies the complete machine state into state. Allocates nothing, so
+        // it's cheap enough to do every frame.
+        void saveState(State& state) const;
+
+        // Puts the machine back into a saved state. Memory is only redecoded
+        // if it differs from what's loaded, and a ROM's translation is kept
+        // as long as it doesn't; restoring a state saved from the same ROM is
+        // just a copy. The framebuffer generation moves on (rather than back)
+        // if the picture changes, with the changed rows marked dirty.
+        // Returns false, leaving the context untouched, for a state no
+        // context could have saved: one with SP past the end of the stack.
+        bool loadState(const State& state);
+
+        void setBreakpoint(std::uint16_t address);
+        void clearBreakpoint(std::uint16_t address);
+
         void loadROM(const std::vector<std::uint8_t>& buffer);
+
+        // Executes a single instruction. With no timer period set the timers
+        // are aged every DEFAULT_CYCLES_PER_FRAME ticks, as runFrame() would
+        // at that rate; mixing tick() with runFrame() ages them for both.
         void tick();
 
+        // Executes up to count instructions back to back with the selected core.
+        // Stops early when the guest waits for a key, hits an unknown opcode or
+        // reaches a breakpoint; resuming after a breakpoint executes the
+        // instruction under it. Time is only measured in instructions, so the
+        // result never depends on how fast the host is.
+        StopReason run(std::uint64_t count);
+
+        // Runs one 60 Hz frame's worth of instructions, then ages the timers
+        // unless a timer period is set. The timers aren't touched if the frame
+        // was cut short by an unknown opcode or a breakpoint.
+        StopReason runFrame(std::uint64_t cyclesPerFrame);
+
     private:
-        struct
+        friend class Jit;
+        friend class AotRuntime;
+
+        using Kind = InstructionKind;
+
+        struct Registers
         {
             std::array<std::uint8_t, NUM_GPRS> V = {{ 0 }};
             std::uint16_t I = 0;
             std::uint16_t PC = INITIAL_PC;
-            std::uint16_t DT = 0;
+            std::uint8_t DT = 0;
+            std::uint8_t ST = 0;
         } m_registers;
 
-        std::stack<std::uint16_t> m_stack;
-        std::array<std::uint8_t, MEMORY_SIZE> m_memory = {{ 0 }};
-        std::array<std::uint8_t, FRAMEBUFFER_SIZE> m_framebuffer = {{ 0 }};
+        // Return addresses, m_SP of them in use.
+        std::array<std::uint16_t, STACK_SIZE> m_stack = {{ 0 }};
+        std::uint8_t m_SP = 0;
+        StackPolicy m_stackPolicy = StackPolicy::Trap;
+        // Both can be shared between forks, so they're only ever changed
+        // through writablePage() and writableDecodeCache(). The decode cache
+        // is shared whole rather than by page so the cores can fetch from it
+        // without going through the page table.
+        using MemoryPage = std::array<std::uint8_t, MEMORY_PAGE_SIZE>;
+        using DecodeCache = std::array<Instruction, MEMORY_SIZE>;
+
+        std::array<std::shared_ptr<MemoryPage>, MEMORY_PAGE_COUNT> m_pages;
+        std::shared_ptr<DecodeCache> m_decoded;
+
+        // Which of them this context copied itself and hasn't forked since,
+        // so it can write them in place. Tracked here rather than read off
+        // use_count(), which isn't ordered against a fork on another thread
+        // dropping its reference. fork() clears them on the parent as well.
+        mutable std::bitset<MEMORY_PAGE_COUNT> m_ownedPages;
+        mutable bool m_ownsDecodeCache = false;
+        Framebuffer m_framebuffer = {{ 0 }};
+        std::uint64_t m_framebufferGeneration = 0;
+        DirtyRows m_dirtyRows = 0;
+        std::bitset<MEMORY_SIZE> m_breakpoints;
+        std::uint16_t m_keys = 0;
+        Random m_random;
+        std::uint64_t m_cycles = 0;
+        std::uint64_t m_idleCycles = 0;
+        bool m_skipIdleLoops = true;
+
+        // Instructions per timer step, and how many are left until the next.
+        // With no period set, the countdown counts tick() calls instead.
+        std::uint64_t m_timerPeriod = 0;
+        std::uint64_t m_timerCountdown = 0;
+
+        Core m_core = Core::Table;
+        std::unique_ptr<Jit> m_jit;
+        const AotProgram* m_aot = nullptr;
+
+        // Set by handlers to end the current run() early; BudgetExhausted
+        // while nothing has asked to stop.
+        StopReason m_stopReason = StopReason::BudgetExhausted;
+        bool m_resumeFromBreakpoint = false;
+
+#if CHIP8_PROFILE
+        Profile m_profile;
+#endif
+
+        using InstructionHandler = std::optional<std::uint16_t>(Chip8Context::*)(const Instruction&);
+
+        // One handler per opcode nibble, plus ones for breakpoints and idle
+        // loops which are patched into the decode cache.
+        static const std::size_t BREAKPOINT_HANDLER = 16;
+        static const std::size_t IDLE_LOOP_HANDLER = 17;
+        static const std::array<InstructionHandler, 18> instructionHandlers;
+
+        // The zeroed page and its decoding that every context starts out
+        // sharing.
+        static const std::shared_ptr<MemoryPage>& getBlankPage();
+        static const std::shared_ptr<DecodeCache>& getBlankDecodeCache();
+
+        std::uint8_t readMemory(std::uint16_t address) const
+        {
+            address &= MEMORY_SIZE - 1;
+            return (*m_pages[address / MEMORY_PAGE_SIZE])[address % MEMORY_PAGE_SIZE];
+        }
+
+        const Instruction& getDecoded(std::uint16_t address) const
+        {
+            return (*m_decoded)[address & (MEMORY_SIZE - 1)];
+        }
+
+        // Copied first if anything else shares them.
+        MemoryPage& writablePage(std::size_t index);
+        DecodeCache& writableDecodeCache();
+
+        // Copies data into memory from address on, leaving pages it doesn't
+        // change shared. Returns whether anything changed; the decode cache
+        // is left for the caller to bring up to date.
+        bool copyToMemory(std::uint16_t address, const std::uint8_t* data, std::size_t size);
+
+        Instruction decode(std::uint16_t address) const;
+        void redecode(std::uint16_t address);
+        void predecode();
+
+        void reportUnknownInstruction(std::uint16_t instruction);
+
+        // Applies the stack policy to a CALL (overflow) or RET at PC, and
+        // returns whether the instruction should go ahead.
+        bool handleStackFault(std::uint16_t pc, bool overflow);
+
+        // Shared by every core. Return false, with the stack untouched, if
+        // the instruction has to stop instead.
+        bool pushReturnAddress(std::uint16_t pc, std::uint16_t address)
+        {
+            if (m_SP >= STACK_SIZE) {
+                if (!handleStackFault(pc, true)) {
+                    return false;
+                }
+
+                m_SP = 0;
+            }
+
+            m_stack[m_SP++] = address;
+            return true;
+        }
 
-        std::chrono::high_resolution_clock::time_point m_lastTick = std::chrono::high_resolution_clock::now();
+        bool popReturnAddress(std::uint16_t pc, std::uint16_t& address)
+        {
+            if (m_SP == 0) {
+                if (!handleStackFault(pc, false)) {
+                    return false;
+                }
+
+                m_SP = STACK_SIZE;
+            }
+
+            address = m_stack[--m_SP];
+            return true;
+        }
+
+        // Called by the cores for each instruction they execute at pc; the
+        // threaded core counts as it dispatches, so takes it back again when
+        // the instruction stops instead. Nothing unless profiling.
+        void countInstruction(std::uint16_t pc, Kind kind)
+        {
+#if CHIP8_PROFILE
+            m_profile.kinds[static_cast<std::size_t>(kind)]++;
+            m_profile.addresses[pc & (MEMORY_SIZE - 1)]++;
+#else
+            static_cast<void>(pc);
+            static_cast<void>(kind);
+#endif
+        }
+
+        void uncountInstruction(std::uint16_t pc, Kind kind)
+        {
+#if CHIP8_PROFILE
+            m_profile.kinds[static_cast<std::size_t>(kind)]--;
+            m_profile.addresses[pc & (MEMORY_SIZE - 1)]--;
+#else
+            static_cast<void>(pc);
+            static_cast<void>(kind);
+#endif
+        }
 
-        using InstructionHandler = std::optional<std::uint16_t>(Chip8Context::*)(std::uint16_t);
-        static const std::array<InstructionHandler, 16> instructionHandlers;
+        void tickTimers();
+        void advanceTimers(std::uint64_t executed);
+        std::uint64_t skipIdleLoop(std::uint64_t budget);
+        void clearScreen();
+        void drawSprite(std::uint8_t x, std::uint8_t y, std::uint8_t rows);
 
-        void warnUnknownInstruction(std::uint16_t instruction);
+        bool executeInstruction(const Instruction& instruction);
 
-        std::optional<std::uint16_t> handle0(std::uint16_t instruction);
-        std::optional<std::uint16_t> handleJP(std::uint16_t instruction);
-        std::optional<std::uint16_t> handleCALL(std::uint16_t instruction);
-        std::optional<std::uint16_t> handleSE(std::uint16_t instruction);
-        std::optional<std::uint16_t> handleSNE(std::uint16_t instruction);
-        std::optional<std::uint16_t> handleDRW(std::uint16_t instruction);
-        std::optional<std::uint16_t> handleLDI(std::uint16_t instruction);
-        std::optional<std::uint16_t> handleLD(std::uint16_t instruction);
-        std::optional<std::uint16_t> handleADD(std::uint16_t instruction);
-        std::optional<std::uint16_t> handleRND(std::uint16_t instruction);
-        std::optional<std::uint16_t> handleF(std::uint16_t instruction);
-        std::optional<std::uint16_t> handle8(std::uint16_t instruction);
+        std::uint64_t executeCore(std::uint64_t count);
+        std::uint64_t executeTable(std::uint64_t count);
+        std::uint64_t executeThreaded(std::uint64_t count);
+        std::uint64_t executeJit(std::uint64_t count);
+        std::uint64_t executeAot(std::uint64_t count);
 
+        std::optional<std::uint16_t> handleUnknown(const Instruction& instruction);
+        std::optional<std::uint16_t> handleBreakpoint(const Instruction& instruction);
+        std::optional<std::uint16_t> handleIdleLoop(const Instruction& instruction);
+        std::optional<std::uint16_t> handle0(const Instruction& instruction);
+        std::optional<std::uint16_t> handleJP(const Instruction& instruction);
+        std::optional<std::uint16_t> handleCALL(const Instruction& instruction);
+        std::optional<std::uint16_t> handleSE(const Instruction& instruction);
+        std::optional<std::uint16_t> handleSNE(const Instruction& instruction);
+        std::optional<std::uint16_t> handleDRW(const Instruction& instruction);
+        std::optional<std::uint16_t> handleLDI(const Instruction& instruction);
+        std::optional<std::uint16_t> handleLD(const Instruction& instruction);
+        std::optional<std::uint16_t> handleADD(const Instruction& instruction);
+        std::optional<std::uint16_t> handleRND(const Instruction& instruction);
+        std::optional<std::uint16_t> handleE(const Instruction& instruction);
+        std::optional<std::uint16_t> handleF(const Instruction& instruction);
+        std::optional<std::uint16_t> handle8(const Instruction& instruction);
     };
 }
 
@@ -0,0 +1,137 @@
+#include <cstdint>
+#include <cstring>
+#include <experimental/filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "format.h"
+#include "chip8.h"
+#include "cli.h"
+#include "expand.h"
+
+namespace fs = std::experimental::filesystem;
+
+namespace chip8
+{
+    bool readFile(const std::string& path, std::vector<std::uint8_t>& buffer)
+    {
+        if (!fs::exists(path)) {
+            return false;
+        }
+
+        buffer.resize(fs::file_size(path));
+        std::ifstream file(path, std::ios::binary);
+        file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+
+        return true;
+    }
+
+    bool parseCore(const char* name, Core& core)
+    {
+        if (std::strcmp(name, "table") == 0) {
+            core = Core::Table;
+        } else if (std::strcmp(name, "threaded") == 0) {
+            core = Core::Threaded;
+        } else if (std::strcmp(name, "jit") == 0) {
+            core = Core::Jit;
+        } else if (std::strcmp(name, "aot") == 0) {
+            core = Core::Aot;
+        } else {
+            return false;
+        }
+
+        return true;
+    }
+
+    const char* getCoreName(Core core)
+    {
+        switch (core) {
+        case Core::Table:    return "table";
+        case Core::Threaded: return "threaded";
+        case Core::Jit:      return "jit";
+        case Core::Aot:      return "aot";
+        }
+
+        return "?";
+    }
+
+    const char* getStopReasonName(StopReason reason)
+    {
+        switch (reason) {
+        case StopReason::BudgetExhausted: return "completed";
+        case StopReason::WaitForKey:      return "wait_for_key";
+        case StopReason::UnknownOpcode:   return "unknown_opcode";
+        case StopReason::Breakpoint:      return "breakpoint";
+        case StopReason::StackFault:      return "stack_fault";
+        case StopReason::IdleLoop:        return "idle_loop";
+        }
+
+        return "?";
+    }
+
+    bool parseStackPolicy(const char* name, StackPolicy& policy)
+    {
+        if (std::strcmp(name, "wrap") == 0) {
+            policy = StackPolicy::Wrap;
+        } else if (std::strcmp(name, "trap") == 0) {
+            policy = StackPolicy::Trap;
+        } else if (std::strcmp(name, "abort") == 0) {
+            policy = StackPolicy::Abort;
+        } else {
+            return false;
+        }
+
+        return true;
+    }
+
+    const char* getExpandKernelName(ExpandKernel kernel)
+    {
+        switch (kernel) {
+        case ExpandKernel::Scalar: return "scalar";
+        case ExpandKernel::Sse2:   return "sse2";
+        case ExpandKernel::Avx2:   return "avx2";
+        }
+
+        return "?";
+    }
+
+    std::string quoteJson(const std::string& text)
+    {
+        std::string quoted = "\"";
+
+        for (auto c : text) {
+            const auto byte = static_cast<unsigned char>(c);
+
+            if (c == '"' || c == '\\') {
+                quoted += '\\';
+                quoted += c;
+            } else if (c == '\n') {
+                quoted += "\\n";
+            } else if (c == '\t') {
+                quoted += "\\t";
+            } else if (byte < 0x20) {
+                quoted += fmt::format("\\u{:04x}", static_cast<unsigned>(byte));
+            } else {
+                quoted += c;
+            }
+        }
+
+        return quoted + "\"";
+    }
+
+    std::string quoteCsv(const std::string& text)
+    {
+        std::string quoted = "\"";
+
+        for (auto c : text) {
+            if (c == '"') {
+                quoted += '"';
+            }
+
+            quoted += c;
+        }
+
+        return quoted + "\"";
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "chip8.h"
+#include "expand.h"
+
+// Helpers shared by the command line front ends, tools and benchmarks.
+
+namespace chip8
+{
+    // Reads a whole file into buffer. Returns false if there's no such file.
+    bool readFile(const std::string& path, std::vector<std::uint8_t>& buffer);
+
+    // Core names as given to --core: "table", "threaded", "jit" or "aot".
+    // Parsing returns false, leaving core untouched, for anything else.
+    bool parseCore(const char* name, Core& core);
+    const char* getCoreName(Core core);
+
+    // "completed", "wait_for_key", "unknown_opcode", "breakpoint",
+    // "stack_fault" or "idle_loop", as written to batch results.
+    const char* getStopReasonName(StopReason reason);
+
+    // Stack policy names as given to --stack: "wrap", "trap" or "abort".
+    bool parseStackPolicy(const char* name, StackPolicy& policy);
+
+    // "scalar", "sse2" or "avx2".
+    const char* getExpandKernelName(ExpandKernel kernel);
+
+    // Quotes text as a JSON string, escaping control characters too, or as a
+    // CSV field with any quotes in it doubled.
+    std::string quoteJson(const std::string& text);
+    std::string quoteCsv(const std::string& text);
+}
+
+#endif
@@ -0,0 +1,255 @@
+#include <cstddef>
+#include <cstdint>
+
+#include "expand.h"
+
+#if CHIP8_EXPAND_SSE2 || CHIP8_EXPAND_AVX2
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    using chip8::FramebufferRow;
+    using chip8::Palette;
+
+    const std::size_t ROW_BYTES = sizeof(FramebufferRow);
+
+    void expandRowsScalar(const FramebufferRow* rows, std::size_t count, std::uint32_t* pixels,
+                          std::size_t pitch, const Palette& palette)
+    {
+        for (std::size_t y = 0; y < count; y++) {
+            auto row = rows[y];
+            auto out = pixels + y * pitch;
+
+            for (std::size_t x = 0; x < chip8::FRAMEBUFFER_WIDTH; x++) {
+                *out++ = (row >> (chip8::FRAMEBUFFER_WIDTH - 1)) ? palette.foreground : palette.background;
+                row <<= 1;
+            }
+        }
+    }
+
+    void expandBytesScalar(const std::uint8_t* bytes, std::size_t count, std::uint32_t* pixels,
+                           const Palette& palette)
+    {
+        for (std::size_t i = 0; i < count; i++) {
+            pixels[i] = bytes[i] ? palette.foreground : palette.background;
+        }
+    }
+
+#if CHIP8_EXPAND_SSE2
+    // Picks background ^ difference where mask is set and background
+    // elsewhere, difference being foreground ^ background.
+    __m128i select128(__m128i mask, __m128i background, __m128i difference)
+    {
+        return _mm_xor_si128(background, _mm_and_si128(mask, difference));
+    }
+
+    // Expands 16 byte masks to four vectors of dword masks and stores the
+    // selected pixels.
+    void store16(__m128i* out, __m128i mask, __m128i base, __m128i difference)
+    {
+        const auto words0 = _mm_unpacklo_epi8(mask, mask);
+        const auto words1 = _mm_unpackhi_epi8(mask, mask);
+
+        _mm_storeu_si128(out + 0, select128(_mm_unpacklo_epi16(words0, words0), base, difference));
+        _mm_storeu_si128(out + 1, select128(_mm_unpackhi_epi16(words0, words0), base, difference));
+        _mm_storeu_si128(out + 2, select128(_mm_unpacklo_epi16(words1, words1), base, difference));
+        _mm_storeu_si128(out + 3, select128(_mm_unpackhi_epi16(words1, words1), base, difference));
+    }
+
+    void expandRowsSse2(const FramebufferRow* rows, std::size_t count, std::uint32_t* pixels,
+                        std::size_t pitch, const Palette& palette)
+    {
+        static_assert(ROW_BYTES == 8, "The SSE2 kernel expands 64 pixel rows");
+
+        const auto background = _mm_set1_epi32(static_cast<int>(palette.background));
+        const auto difference = _mm_set1_epi32(static_cast<int>(palette.foreground ^ palette.background));
+        const auto bits = _mm_set1_epi64x(0x0102040810204080);
+
+        for (std::size_t y = 0; y < count; y++) {
+            // Spread each byte of the row over the eight lanes of its pixels.
+            // The row is little endian, so the halves of each pair of bytes
+            // are swapped and the pairs taken from the top down to get the
+            // leftmost pixels first.
+            const auto bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&rows[y]));
+            const auto pairs = _mm_unpacklo_epi8(bytes, bytes);
+            const auto quads0 = _mm_unpacklo_epi16(pairs, pairs);
+            const auto quads1 = _mm_unpackhi_epi16(pairs, pairs);
+            const __m128i spread[] = {
+                _mm_shuffle_epi32(_mm_unpackhi_epi32(quads1, quads1), _MM_SHUFFLE(1, 0, 3, 2)),
+                _mm_shuffle_epi32(_mm_unpacklo_epi32(quads1, quads1), _MM_SHUFFLE(1, 0, 3, 2)),
+                _mm_shuffle_epi32(_mm_unpackhi_epi32(quads0, quads0), _MM_SHUFFLE(1, 0, 3, 2)),
+                _mm_shuffle_epi32(_mm_unpacklo_epi32(quads0, quads0), _MM_SHUFFLE(1, 0, 3, 2)),
+            };
+
+            auto out = reinterpret_cast<__m128i*>(pixels + y * pitch);
+
+            for (const auto& group : spread) {
+                store16(out, _mm_cmpeq_epi8(_mm_and_si128(group, bits), bits), background, difference);
+                out += 4;
+            }
+        }
+    }
+
+    void expandBytesSse2(const std::uint8_t* bytes, std::size_t count, std::uint32_t* pixels,
+                         const Palette& palette)
+    {
+        // Selecting from the foreground with the unlit mask flips the roles.
+        const auto foreground = _mm_set1_epi32(static_cast<int>(palette.foreground));
+        const auto difference = _mm_set1_epi32(static_cast<int>(palette.foreground ^ palette.background));
+        const auto zero = _mm_setzero_si128();
+
+        std::size_t i = 0;
+
+        for (; i + 16 <= count; i += 16) {
+            const auto unlit = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i)), zero);
+            store16(reinterpret_cast<__m128i*>(pixels + i), unlit, foreground, difference);
+        }
+
+        expandBytesScalar(bytes + i, count - i, pixels + i, palette);
+    }
+#endif
+
+#if CHIP8_EXPAND_AVX2
+    // Stores the pixels for 32 byte masks: set where the mask is, unset
+    // elsewhere.
+    __attribute__((target("avx2")))
+    void store32(__m256i* out, __m256i mask, __m256i unset, __m256i set)
+    {
+        const auto low = _mm256_castsi256_si128(mask);
+        const auto high = _mm256_extracti128_si256(mask, 1);
+
+        _mm256_storeu_si256(out + 0, _mm256_blendv_epi8(unset, set, _mm256_cvtepi8_epi32(low)));
+        _mm256_storeu_si256(out + 1, _mm256_blendv_epi8(unset, set, _mm256_cvtepi8_epi32(_mm_srli_si128(low, 8))));
+        _mm256_storeu_si256(out + 2, _mm256_blendv_epi8(unset, set, _mm256_cvtepi8_epi32(high)));
+        _mm256_storeu_si256(out + 3, _mm256_blendv_epi8(unset, set, _mm256_cvtepi8_epi32(_mm_srli_si128(high, 8))));
+    }
+
+    __attribute__((target("avx2")))
+    void expandRowsAvx2(const FramebufferRow* rows, std::size_t count, std::uint32_t* pixels,
+                        std::size_t pitch, const Palette& palette)
+    {
+        static_assert(ROW_BYTES == 8, "The AVX2 kernel expands 64 pixel rows");
+
+        const auto foreground = _mm256_set1_epi32(static_cast<int>(palette.foreground));
+        const auto background = _mm256_set1_epi32(static_cast<int>(palette.background));
+        const auto bits = _mm256_set1_epi64x(0x0102040810204080);
+
+        // Byte lanes to copy each row byte into, leftmost (most significant)
+        // pixels first. Shuffles stay within 128-bit halves, which each hold
+        // a copy of the whole row.
+        const __m256i halves[] = {
+            _mm256_setr_epi8(7, 7, 7, 7, 7, 7, 7, 7, 6, 6, 6, 6, 6, 6, 6, 6,
+                             5, 5, 5, 5, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4),
+            _mm256_setr_epi8(3, 3, 3, 3, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2,
+                             1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0),
+        };
+
+        for (std::size_t y = 0; y < count; y++) {
+            const auto row = _mm256_set1_epi64x(static_cast<long long>(rows[y]));
+            auto out = reinterpret_cast<__m256i*>(pixels + y * pitch);
+
+            for (const auto& lanes : halves) {
+                const auto spread = _mm256_and_si256(_mm256_shuffle_epi8(row, lanes), bits);
+                store32(out, _mm256_cmpeq_epi8(spread, bits), background, foreground);
+                out += 4;
+            }
+        }
+    }
+
+    __attribute__((target("avx2")))
+    void expandBytesAvx2(const std::uint8_t* bytes, std::size_t count, std::uint32_t* pixels,
+                         const Palette& palette)
+    {
+        const auto foreground = _mm256_set1_epi32(static_cast<int>(palette.foreground));
+        const auto background = _mm256_set1_epi32(static_cast<int>(palette.background));
+        const auto zero = _mm256_setzero_si256();
+
+        std::size_t i = 0;
+
+        for (; i + 32 <= count; i += 32) {
+            const auto unlit = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + i)), zero);
+            store32(reinterpret_cast<__m256i*>(pixels + i), unlit, foreground, background);
+        }
+
+        expandBytesScalar(bytes + i, count - i, pixels + i, palette);
+    }
+#endif
+}
+
+namespace chip8
+{
+    bool isExpandKernelSupported(ExpandKernel kernel)
+    {
+        switch (kernel) {
+        case ExpandKernel::Scalar:
+            return true;
+
+        case ExpandKernel::Sse2:
+            return CHIP8_EXPAND_SSE2 != 0;
+
+        case ExpandKernel::Avx2:
+#if CHIP8_EXPAND_AVX2
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+        }
+
+        return false;
+    }
+
+    ExpandKernel getFastestExpandKernel()
+    {
+        static const ExpandKernel fastest =
+            isExpandKernelSupported(ExpandKernel::Avx2) ? ExpandKernel::Avx2 :
+            isExpandKernelSupported(ExpandKernel::Sse2) ? ExpandKernel::Sse2 :
+            ExpandKernel::Scalar;
+
+        return fastest;
+    }
+
+    void expandRows(const FramebufferRow* rows, std::size_t count, std::uint32_t* pixels, std::size_t pitch,
+                    const Palette& palette, ExpandKernel kernel)
+    {
+        switch (kernel) {
+#if CHIP8_EXPAND_AVX2
+        case ExpandKernel::Avx2:
+            expandRowsAvx2(rows, count, pixels, pitch, palette);
+            return;
+#endif
+
+#if CHIP8_EXPAND_SSE2
+        case ExpandKernel::Sse2:
+            expandRowsSse2(rows, count, pixels, pitch, palette);
+            return;
+#endif
+
+        default:
+            expandRowsScalar(rows, count, pixels, pitch, palette);
+            return;
+        }
+    }
+
+    void expandBytes(const std::uint8_t* bytes, std::size_t count, std::uint32_t* pixels,
+                     const Palette& palette, ExpandKernel kernel)
+    {
+        switch (kernel) {
+#if CHIP8_EXPAND_AVX2
+        case ExpandKernel::Avx2:
+            expandBytesAvx2(bytes, count, pixels, palette);
+            return;
+#endif
+
+#if CHIP8_EXPAND_SSE2
+        case ExpandKernel::Sse2:
+            expandBytesSse2(bytes, count, pixels, palette);
+            return;
+#endif
+
+        default:
+            expandBytesScalar(bytes, count, pixels, palette);
+            return;
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "chip8.h"
+
+// SSE2 is part of x86-64, so it's always there; AVX2 is compiled with a
+// function level target attribute and picked at run time if the CPU has it.
+#if defined(__SSE2__)
+#define CHIP8_EXPAND_SSE2 1
+#else
+#define CHIP8_EXPAND_SSE2 0
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CHIP8_EXPAND_AVX2 1
+#else
+#define CHIP8_EXPAND_AVX2 0
+#endif
+
+namespace chip8
+{
+    // Colours as 32-bit pixels in whatever format the destination uses, e.g.
+    // 0xRRGGBBAA for SDL_PIXELFORMAT_RGBA8888.
+    struct Palette
+    {
+        std::uint32_t background;
+        std::uint32_t foreground;
+    };
+
+    const Palette DEFAULT_PALETTE = { 0x00000000, 0xFFFFFFFF };
+
+    enum class ExpandKernel
+    {
+        Scalar,
+        Sse2,
+        Avx2,
+    };
+
+    bool isExpandKernelSupported(ExpandKernel kernel);
+
+    // The widest kernel the host supports.
+    ExpandKernel getFastestExpandKernel();
+
+    // Expands count packed framebuffer rows to FRAMEBUFFER_WIDTH pixels each,
+    // starting a new output row every pitch pixels.
+    void expandRows(const FramebufferRow* rows, std::size_t count, std::uint32_t* pixels, std::size_t pitch,
+                    const Palette& palette, ExpandKernel kernel = getFastestExpandKernel());
+
+    // Expands count byte per pixel values, any nonzero byte being lit.
+    void expandBytes(const std::uint8_t* bytes, std::size_t count, std::uint32_t* pixels,
+                     const Palette& palette, ExpandKernel kernel = getFastestExpandKernel());
+}
+
+#endif
@@ -0,0 +1,293 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "format.h"
+#include "chip8.h"
+#include "cli.h"
+#include "movie.h"
+#include "profile.h"
+#include "state.h"
+
+// Runs a ROM flat out with no window, sound or input, for batch jobs and
+// machines without SDL. Prints what happened and a hash of the final
+// framebuffer to compare runs by. Can also record the run as a movie, or
+// play one back and check it reaches the same states.
+
+static const std::uint64_t CYCLES_PER_FRAME = chip8::DEFAULT_CYCLES_PER_FRAME;
+static const std::uint64_t FRAMES = 600;
+
+struct Options
+{
+    const char* romPath = nullptr;
+    std::uint64_t cyclesPerFrame = CYCLES_PER_FRAME;
+    std::uint64_t frames = FRAMES;
+    chip8::Core core = chip8::Core::Table;
+    chip8::StackPolicy stackPolicy = chip8::StackPolicy::Trap;
+    std::uint32_t seed = 0;
+    const char* loadStatePath = nullptr;
+    const char* saveStatePath = nullptr;
+    const char* recordPath = nullptr;
+    const char* replayPath = nullptr;
+    const char* profilePath = nullptr;
+    const char* flamegraphPath = nullptr;
+    bool dump = false;
+};
+
+static bool parseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (std::strcmp(arg, "--dump") == 0) {
+            options.dump = true;
+        } else if (std::strcmp(arg, "--cycles") == 0 && hasValue) {
+            options.cyclesPerFrame = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(arg, "--frames") == 0 && hasValue) {
+            options.frames = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(arg, "--seed") == 0 && hasValue) {
+            options.seed = std::strtoul(argv[++i], nullptr, 0);
+        } else if (std::strcmp(arg, "--core") == 0 && hasValue) {
+            if (!chip8::parseCore(argv[++i], options.core)) {
+                return false;
+            }
+        } else if (std::strcmp(arg, "--stack") == 0 && hasValue) {
+            if (!chip8::parseStackPolicy(argv[++i], options.stackPolicy)) {
+                return false;
+            }
+        } else if (std::strcmp(arg, "--load-state") == 0 && hasValue) {
+            options.loadStatePath = argv[++i];
+        } else if (std::strcmp(arg, "--save-state") == 0 && hasValue) {
+            options.saveStatePath = argv[++i];
+        } else if (std::strcmp(arg, "--record") == 0 && hasValue) {
+            options.recordPath = argv[++i];
+        } else if (std::strcmp(arg, "--replay") == 0 && hasValue) {
+            options.replayPath = argv[++i];
+        } else if (std::strcmp(arg, "--profile") == 0 && hasValue) {
+            options.profilePath = argv[++i];
+        } else if (std::strcmp(arg, "--flamegraph") == 0 && hasValue) {
+            options.flamegraphPath = argv[++i];
+        } else if (arg[0] != '-' && !options.romPath) {
+            options.romPath = arg;
+        } else {
+            return false;
+        }
+    }
+
+    // Movies start from power-on.
+    if ((options.recordPath || options.replayPath) && options.loadStatePath) {
+        return false;
+    }
+
+    return options.romPath != nullptr && options.cyclesPerFrame > 0 && !(options.recordPath && options.replayPath);
+}
+
+static void dumpFramebuffer(const chip8::Framebuffer& rows)
+{
+    for (auto row : rows) {
+        std::string line(chip8::FRAMEBUFFER_WIDTH, '.');
+
+        for (std::size_t x = 0; x < chip8::FRAMEBUFFER_WIDTH; x++) {
+            if ((row >> (chip8::FRAMEBUFFER_WIDTH - 1 - x)) & 1) {
+                line[x] = '#';
+            }
+        }
+
+        fmt::print("{}\n", line);
+    }
+}
+
+// Writes whichever profiles were asked for. Returns false if one couldn't
+// be written.
+static bool writeProfiles(const chip8::Chip8Context& context, const Options& options)
+{
+    if (options.profilePath) {
+        auto file = std::unique_ptr<std::FILE, decltype(&std::fclose)>(std::fopen(options.profilePath, "w"),
+                                                                       std::fclose);
+        if (!file) {
+            fmt::print("Couldn't write the profile to {}\n", options.profilePath);
+            return false;
+        }
+
+        chip8::writeProfileJson(file.get(), context);
+    }
+
+    if (options.flamegraphPath) {
+        auto file = std::unique_ptr<std::FILE, decltype(&std::fclose)>(std::fopen(options.flamegraphPath, "w"),
+                                                                       std::fclose);
+        if (!file) {
+            fmt::print("Couldn't write the profile to {}\n", options.flamegraphPath);
+            return false;
+        }
+
+        chip8::writeProfileCollapsed(file.get(), context);
+    }
+
+    return true;
+}
+
+// Plays back the movie at path, in place of the usual run. The movie's own
+// settings override any given on the command line, bar the core.
+static int replay(const char* path, const std::vector<std::uint8_t>& rom, chip8::Chip8Context& context,
+                  const Options& options)
+{
+    chip8::Movie movie;
+    std::ifstream file(path, std::ios::binary);
+
+    if (!chip8::readMovie(file, movie)) {
+        fmt::print("Couldn't load a version {} movie from {}\n", chip8::MOVIE_FILE_VERSION, path);
+        return 1;
+    }
+
+    if (!chip8::isMovieROM(movie, rom)) {
+        fmt::print("{} wasn't recorded with {}\n", path, options.romPath);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto result = chip8::replayMovie(movie, context);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (options.dump) {
+        dumpFramebuffer(context.getFramebufferRows());
+    }
+
+    if (!writeProfiles(context, options)) {
+        return 1;
+    }
+
+    if (result.diverged) {
+        fmt::print("{}: diverged by frame {} of {}, after {} matching checkpoints\n",
+                   path, result.frames, movie.keys.size(), result.checkpoints);
+        return 3;
+    }
+
+    fmt::print("{}: matched {} checkpoints over {} frames, {} instructions, {:.3f} s, {:.0f} frames/s, "
+               "framebuffer {:016x}\n",
+               path, result.checkpoints, result.frames, context.getCycles(), elapsed.count(),
+               result.frames / elapsed.count(), chip8::hashFramebuffer(context.getFramebufferRows()));
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        fmt::print("Usage: {} [options] <path to ROM>\n"
+                   "  --cycles N        instructions per 60 Hz frame (default {})\n"
+                   "  --frames N        frames to run (default {})\n"
+                   "  --core C          table, threaded, jit or aot (default table)\n"
+                   "  --stack P         stack overflow policy: wrap, trap or abort (default trap)\n"
+                   "  --seed N          seed for RND (default 0)\n"
+                   "  --load-state F    start from the state saved in F\n"
+                   "  --save-state F    save the final state to F\n"
+                   "  --record F        record the run as a movie in F\n"
+                   "  --replay F        play back the movie in F, checking its state hashes\n"
+                   "  --profile F       write what was executed to F as JSON (needs a PROFILE=1 build)\n"
+                   "  --flamegraph F    write executed addresses to F as collapsed stacks (likewise)\n"
+                   "  --dump            print the final framebuffer\n",
+                   argv[0], CYCLES_PER_FRAME, FRAMES);
+        return 1;
+    }
+
+    if ((options.profilePath || options.flamegraphPath) && !chip8::PROFILING) {
+        fmt::print("Profiles need a build with CHIP8_PROFILE, e.g. make PROFILE=1\n");
+        return 1;
+    }
+
+    std::vector<std::uint8_t> rom;
+    if (!chip8::readFile(options.romPath, rom)) {
+        fmt::print("Couldn't load ROM {}\n", options.romPath);
+        return 1;
+    }
+
+    chip8::Chip8Context context;
+    context.loadROM(rom);
+    context.setCore(options.core);
+    context.setStackPolicy(options.stackPolicy);
+
+    if (options.replayPath) {
+        return replay(options.replayPath, rom, context, options);
+    }
+
+    context.seedRandom(options.seed);
+
+    chip8::Movie movie;
+    if (options.recordPath) {
+        chip8::beginMovie(movie, rom, options.seed, options.cyclesPerFrame, context);
+    }
+
+    if (options.loadStatePath) {
+        chip8::State state;
+        std::ifstream file(options.loadStatePath, std::ios::binary);
+
+        if (!chip8::readState(file, state) || !context.loadState(state)) {
+            fmt::print("Couldn't load a version {} state from {}\n", chip8::STATE_FILE_VERSION, options.loadStatePath);
+            return 1;
+        }
+    }
+
+    // Nothing can press a key, so a ROM waiting for one just lets its frames
+    // go by; an unknown opcode or a trapped stack fault can never get past
+    // itself.
+    auto reason = chip8::StopReason::BudgetExhausted;
+    std::uint64_t frame = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    while (frame < options.frames) {
+        reason = context.runFrame(options.cyclesPerFrame);
+        frame++;
+
+        if (options.recordPath) {
+            chip8::recordFrame(movie, context.getKeys(), context);
+        }
+
+        if (reason == chip8::StopReason::UnknownOpcode || reason == chip8::StopReason::StackFault) {
+            break;
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const auto& rows = context.getFramebufferRows();
+
+    if (options.dump) {
+        dumpFramebuffer(rows);
+    }
+
+    if (options.saveStatePath) {
+        chip8::State state;
+        context.saveState(state);
+
+        std::ofstream file(options.saveStatePath, std::ios::binary);
+        if (!chip8::writeState(file, state)) {
+            fmt::print("Couldn't save the state to {}\n", options.saveStatePath);
+            return 1;
+        }
+    }
+
+    if (!writeProfiles(context, options)) {
+        return 1;
+    }
+
+    if (options.recordPath) {
+        std::ofstream file(options.recordPath, std::ios::binary);
+        if (!chip8::writeMovie(file, movie)) {
+            fmt::print("Couldn't save the movie to {}\n", options.recordPath);
+            return 1;
+        }
+    }
+
+    fmt::print("{}: {} after {} frames, {} instructions ({} idle), {:.3f} s, {:.1f} MIPS, framebuffer {:016x}\n",
+               options.romPath, chip8::getStopReasonName(reason), frame, context.getCycles(), context.getIdleCycles(),
+               elapsed.count(), context.getCycles() / elapsed.count() / 1e6, chip8::hashFramebuffer(rows));
+
+    return reason == chip8::StopReason::UnknownOpcode || reason == chip8::StopReason::StackFault ? 2 : 0;
+}
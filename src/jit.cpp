@@ -0,0 +1,635 @@
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include "chip8.h"
+#include "jit.h"
+
+#if CHIP8_JIT_SUPPORTED
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+    enum HostReg : std::uint8_t
+    {
+        RAX = 0,
+        RCX,
+        RDX,
+        RBX,
+        RSP,
+        RBP,
+        RSI,
+        RDI,
+        R8,
+        R9,
+        R10,
+        R11,
+        R12,
+        R13,
+        R14,
+        R15,
+
+        // In a block's register map, a guest register the block doesn't use.
+        UNMAPPED = 0xFF,
+    };
+
+    // Registers handed out to guest state, caller-saved ones first so short
+    // blocks don't need to save anything. RAX is scratch and RDI holds the
+    // pointer to the guest registers.
+    const std::array<HostReg, 13> ALLOCATABLE_REGS = {{
+        RCX, RDX, RSI, R8, R9, R10, R11, RBX, RBP, R12, R13, R14, R15,
+    }};
+
+    bool isCalleeSaved(HostReg reg)
+    {
+        return reg == RBX || reg == RBP || reg >= R12;
+    }
+
+    // Guest register numbers used by the allocator: V0-VF, then I.
+    const std::size_t GUEST_I = 16;
+    const std::size_t NUM_GUEST_REGS = 17;
+
+    // Upper bound on the machine code emitted for one block: each guest
+    // instruction is at most ~30 bytes and a block has at most two exits.
+    const std::size_t MAX_BLOCK_BYTES = 8192;
+
+    enum AluOp : std::uint8_t
+    {
+        ALU_ADD = 0,
+        ALU_OR = 1,
+        ALU_AND = 4,
+        ALU_SUB = 5,
+        ALU_XOR = 6,
+        ALU_CMP = 7,
+    };
+
+    enum Condition : std::uint8_t
+    {
+        CC_E = 0x4,
+        CC_NE = 0x5,
+        CC_A = 0x7,
+    };
+
+    class Emitter
+    {
+    public:
+        Emitter(std::uint8_t* begin, std::uint8_t* end)
+            : m_begin(begin), m_cursor(begin), m_end(end)
+        {
+        }
+
+        std::uint8_t* begin() const
+        {
+            return m_begin;
+        }
+
+        std::size_t size() const
+        {
+            return m_cursor - m_begin;
+        }
+
+        // mov dst32, src32
+        void mov(HostReg dst, HostReg src)
+        {
+            aluRR(0x89, dst, src);
+        }
+
+        // mov dst32, imm32
+        void movImm(HostReg dst, std::uint32_t imm)
+        {
+            rex(false, 0, dst);
+            emit(0xB8 + (dst & 7));
+            emit32(imm);
+        }
+
+        // add/or/and/sub/xor/cmp dst32, src32
+        void alu(AluOp op, HostReg dst, HostReg src)
+        {
+            aluRR(static_cast<std::uint8_t>(op << 3 | 0x01), dst, src);
+        }
+
+        // add/or/and/sub/xor/cmp dst32, imm32
+        void aluImm(AluOp op, HostReg dst, std::uint32_t imm)
+        {
+            rex(false, 0, dst);
+            emit(0x81);
+            modrm(3, op, dst);
+            emit32(imm);
+        }
+
+        // shl/shr dst32, imm8
+        void shl(HostReg dst, std::uint8_t count) { shift(4, dst, count); }
+        void shr(HostReg dst, std::uint8_t count) { shift(5, dst, count); }
+
+        // setcc al; movzx eax, al
+        void setccEax(Condition cc)
+        {
+            emit(0x0F);
+            emit(0x90 | cc);
+            emit(0xC0);
+            emit(0x0F);
+            emit(0xB6);
+            emit(0xC0);
+        }
+
+        // movzx dst32, byte/word [rdi + disp]
+        void loadByte(HostReg dst, std::uint8_t disp) { load(0xB6, dst, disp); }
+        void loadWord(HostReg dst, std::uint8_t disp) { load(0xB7, dst, disp); }
+
+        // mov byte [rdi + disp], src8
+        void storeByte(std::uint8_t disp, HostReg src)
+        {
+            // Always emit REX so that 4-7 encode SPL/BPL/SIL/DIL, not AH-BH.
+            emit(0x40 | ((src & 8) ? 4 : 0));
+            emit(0x88);
+            modrm(1, src, RDI);
+            emit(disp);
+        }
+
+        // mov word [rdi + disp], src16
+        void storeWord(std::uint8_t disp, HostReg src)
+        {
+            emit(0x66);
+            rex(false, src, RDI);
+            emit(0x89);
+            modrm(1, src, RDI);
+            emit(disp);
+        }
+
+        // mov word [rdi + disp], imm16
+        void storeWordImm(std::uint8_t disp, std::uint16_t imm)
+        {
+            emit(0x66);
+            emit(0xC7);
+            modrm(1, 0, RDI);
+            emit(disp);
+            emit(imm & 0xFF);
+            emit(imm >> 8);
+        }
+
+        void push(HostReg reg)
+        {
+            rex(false, 0, reg);
+            emit(0x50 + (reg & 7));
+        }
+
+        void pop(HostReg reg)
+        {
+            rex(false, 0, reg);
+            emit(0x58 + (reg & 7));
+        }
+
+        void ret()
+        {
+            emit(0xC3);
+        }
+
+        // jcc rel32 with the target left for bind().
+        std::uint8_t* jcc(Condition cc)
+        {
+            emit(0x0F);
+            emit(0x80 | cc);
+            auto fixup = m_cursor;
+            emit32(0);
+            return fixup;
+        }
+
+        void bind(std::uint8_t* fixup)
+        {
+            auto rel = static_cast<std::int32_t>(m_cursor - (fixup + 4));
+            for (auto i = 0; i < 4; i++) {
+                fixup[i] = static_cast<std::uint8_t>(rel >> (i * 8));
+            }
+        }
+
+    private:
+        std::uint8_t* m_begin;
+        std::uint8_t* m_cursor;
+        std::uint8_t* m_end;
+
+        void emit(std::uint8_t byte)
+        {
+            assert(m_cursor < m_end);
+            *m_cursor++ = byte;
+        }
+
+        void emit32(std::uint32_t value)
+        {
+            for (auto i = 0; i < 4; i++) {
+                emit(static_cast<std::uint8_t>(value >> (i * 8)));
+            }
+        }
+
+        void rex(bool w, std::uint8_t reg, std::uint8_t rm)
+        {
+            std::uint8_t prefix = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+            if (prefix != 0x40) {
+                emit(prefix);
+            }
+        }
+
+        void modrm(std::uint8_t mod, std::uint8_t reg, std::uint8_t rm)
+        {
+            emit(static_cast<std::uint8_t>(mod << 6 | (reg & 7) << 3 | (rm & 7)));
+        }
+
+        void aluRR(std::uint8_t opcode, HostReg dst, HostReg src)
+        {
+            rex(false, src, dst);
+            emit(opcode);
+            modrm(3, src, dst);
+        }
+
+        void shift(std::uint8_t ext, HostReg dst, std::uint8_t count)
+        {
+            rex(false, 0, dst);
+            emit(0xC1);
+            modrm(3, ext, dst);
+            emit(count);
+        }
+
+        void load(std::uint8_t opcode, HostReg dst, std::uint8_t disp)
+        {
+            rex(false, dst, RDI);
+            emit(0x0F);
+            emit(opcode);
+            modrm(1, dst, RDI);
+            emit(disp);
+        }
+    };
+}
+
+namespace chip8
+{
+    Jit::Jit()
+    {
+        // Never writable and executable at once, as hardened kernels refuse
+        // such mappings: compile() opens up the pages it writes and closes
+        // them again before anything runs.
+        void* code = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANON, -1, 0);
+
+        if (code != MAP_FAILED) {
+            m_code = static_cast<std::uint8_t*>(code);
+        }
+    }
+
+    Jit::~Jit()
+    {
+        release();
+    }
+
+    bool Jit::protect(std::size_t offset, std::size_t size, bool writable)
+    {
+        const auto pageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        const auto first = offset / pageSize * pageSize;
+        const auto last = std::min((offset + size + pageSize - 1) / pageSize * pageSize, CODE_BUFFER_SIZE);
+
+        return mprotect(m_code + first, last - first, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+    }
+
+    void Jit::release()
+    {
+        if (m_code) {
+            munmap(m_code, CODE_BUFFER_SIZE);
+            m_code = nullptr;
+        }
+
+        m_blocks.fill(Block());
+        m_codeUsed = 0;
+    }
+
+    void Jit::flush()
+    {
+        m_blocks.fill(Block());
+        m_codeUsed = 0;
+        m_stats.flushes++;
+    }
+
+    void Jit::invalidate(std::uint16_t address)
+    {
+        const std::size_t maxBlockSize = MAX_BLOCK_LENGTH * INSTRUCTION_SIZE;
+        const std::size_t first = address >= maxBlockSize ? address - maxBlockSize : 0;
+
+        for (auto start = first; start <= address; start++) {
+            auto& block = m_blocks[start];
+
+            if (block.state != BlockState::Uncompiled && address < start + block.size) {
+                block = Block();
+                m_stats.blocksInvalidated++;
+            }
+        }
+    }
+
+    std::uint64_t Jit::execute(Chip8Context& context, std::uint64_t budget)
+    {
+        const auto pc = context.m_registers.PC;
+        if (!m_code || pc >= MEMORY_SIZE) {
+            return 0;
+        }
+
+        auto& block = m_blocks[pc];
+        if (block.state == BlockState::Uncompiled) {
+            compile(context, pc);
+        }
+
+        if (block.state != BlockState::Compiled || block.length > budget) {
+            return 0;
+        }
+
+        block.code(&context.m_registers);
+        m_stats.nativeInstructions += block.length;
+
+        return block.length;
+    }
+
+    void Jit::compile(const Chip8Context& context, std::uint16_t address)
+    {
+        using Kind = InstructionKind;
+        using Registers = Chip8Context::Registers;
+
+        const auto bit = [](std::size_t guest) { return 1u << guest; };
+        const auto VF = bit(0xF);
+
+        // First pass: find where the block ends and which guest registers it
+        // needs, stopping early if it would need more host registers than we have.
+        std::uint32_t used = 0;
+        std::uint32_t written = 0;
+        std::size_t length = 0;
+        std::uint16_t pc = address;
+        bool terminated = false;
+
+        while (!terminated && length < MAX_BLOCK_LENGTH && pc + 1u < MEMORY_SIZE) {
+            const auto& instruction = context.getDecoded(pc);
+            const auto x = bit(instruction.x);
+            const auto y = bit(instruction.y);
+
+            std::uint32_t reads = 0;
+            std::uint32_t writes = 0;
+            bool supported = true;
+
+            switch (instruction.kind) {
+            case Kind::LD:      writes = x; break;
+            case Kind::ADD:     reads = x; writes = x; break;
+            case Kind::LD_VV:   reads = y; writes = x; break;
+            case Kind::OR:
+            case Kind::AND:
+            case Kind::XOR:     reads = x | y; writes = x; break;
+            case Kind::ADD_VV:
+            case Kind::SUB:
+            case Kind::SUBN:    reads = x | y; writes = x | VF; break;
+            case Kind::SHR:
+            case Kind::SHL:     reads = x; writes = x | VF; break;
+            case Kind::LDI:     writes = bit(GUEST_I); break;
+            case Kind::ADD_I_V: reads = x | bit(GUEST_I); writes = bit(GUEST_I); break;
+            case Kind::SE:
+            case Kind::SNE:     reads = x; terminated = true; break;
+            case Kind::JP:      terminated = true; break;
+            default:            supported = false; break;
+            }
+
+            if (!supported) {
+                break;
+            }
+
+            auto needed = used | reads | writes;
+            if (static_cast<std::size_t>(__builtin_popcount(needed)) > ALLOCATABLE_REGS.size()) {
+                terminated = false;
+                break;
+            }
+
+            used = needed;
+            written |= writes;
+            length++;
+            pc += INSTRUCTION_SIZE;
+        }
+
+        auto& block = m_blocks[address];
+
+        if (length == 0) {
+            block.state = BlockState::Unsupported;
+            block.size = INSTRUCTION_SIZE;
+            return;
+        }
+
+        if (m_codeUsed + MAX_BLOCK_BYTES > CODE_BUFFER_SIZE) {
+            flush();
+        }
+
+        if (!protect(m_codeUsed, MAX_BLOCK_BYTES, true)) {
+            release();
+            return;
+        }
+
+        // Second pass: allocate host registers and emit the code.
+        std::array<HostReg, NUM_GUEST_REGS> map;
+        std::size_t numAllocated = 0;
+        map.fill(UNMAPPED);
+
+        for (std::size_t guest = 0; guest < NUM_GUEST_REGS; guest++) {
+            if (used & bit(guest)) {
+                map[guest] = ALLOCATABLE_REGS[numAllocated++];
+            }
+        }
+
+        const auto offsetV = static_cast<std::uint8_t>(offsetof(Registers, V));
+        const auto offsetI = static_cast<std::uint8_t>(offsetof(Registers, I));
+        const auto offsetPC = static_cast<std::uint8_t>(offsetof(Registers, PC));
+
+        Emitter emit(m_code + m_codeUsed, m_code + m_codeUsed + MAX_BLOCK_BYTES);
+
+        for (std::size_t i = 0; i < numAllocated; i++) {
+            if (isCalleeSaved(ALLOCATABLE_REGS[i])) {
+                emit.push(ALLOCATABLE_REGS[i]);
+            }
+        }
+
+        for (std::size_t guest = 0; guest < NUM_GUEST_REGS; guest++) {
+            if (!(used & bit(guest))) {
+                continue;
+            }
+
+            if (guest == GUEST_I) {
+                emit.loadWord(map[guest], offsetI);
+            } else {
+                emit.loadByte(map[guest], static_cast<std::uint8_t>(offsetV + guest));
+            }
+        }
+
+        // Only the operands an instruction actually uses were given host
+        // registers by the first pass, so each is looked up as it's needed.
+        const auto host = [&](std::size_t guest) {
+            assert(map[guest] != UNMAPPED);
+            return map[guest];
+        };
+
+        const auto emitExit = [&](std::uint16_t nextPc) {
+            for (std::size_t guest = 0; guest < NUM_GUEST_REGS; guest++) {
+                if (!(written & bit(guest))) {
+                    continue;
+                }
+
+                if (guest == GUEST_I) {
+                    emit.storeWord(offsetI, map[guest]);
+                } else {
+                    emit.storeByte(static_cast<std::uint8_t>(offsetV + guest), map[guest]);
+                }
+            }
+
+            emit.storeWordImm(offsetPC, nextPc);
+
+            for (auto i = numAllocated; i-- > 0;) {
+                if (isCalleeSaved(ALLOCATABLE_REGS[i])) {
+                    emit.pop(ALLOCATABLE_REGS[i]);
+                }
+            }
+
+            emit.ret();
+        };
+
+        // Each sequence below mirrors the order of operations in the
+        // corresponding handler, so aliasing between Vx, Vy and VF behaves
+        // exactly like the interpreter.
+        pc = address;
+        for (std::size_t i = 0; i < length; i++, pc += INSTRUCTION_SIZE) {
+            const auto& instruction = context.getDecoded(pc);
+            const auto x = instruction.x;
+            const auto y = instruction.y;
+
+            switch (instruction.kind) {
+            case Kind::LD:
+                emit.movImm(host(x), instruction.nn);
+                break;
+
+            case Kind::ADD:
+                emit.aluImm(ALU_ADD, host(x), instruction.nn);
+                emit.aluImm(ALU_AND, host(x), 0xFF);
+                break;
+
+            case Kind::LD_VV:
+                emit.mov(host(x), host(y));
+                break;
+
+            case Kind::OR:  emit.alu(ALU_OR, host(x), host(y)); break;
+            case Kind::AND: emit.alu(ALU_AND, host(x), host(y)); break;
+            case Kind::XOR: emit.alu(ALU_XOR, host(x), host(y)); break;
+
+            case Kind::ADD_VV:
+                emit.mov(RAX, host(x));
+                emit.alu(ALU_ADD, RAX, host(y));
+                emit.mov(host(0xF), RAX);
+                emit.shr(host(0xF), 8);
+                emit.aluImm(ALU_AND, RAX, 0xFF);
+                emit.mov(host(x), RAX);
+                break;
+
+            case Kind::SUB:
+                emit.alu(ALU_CMP, host(x), host(y));
+                emit.setccEax(CC_A);
+                emit.mov(host(0xF), RAX);
+                emit.alu(ALU_SUB, host(x), host(y));
+                emit.aluImm(ALU_AND, host(x), 0xFF);
+                break;
+
+            case Kind::SHR:
+                emit.mov(RAX, host(x));
+                emit.aluImm(ALU_AND, RAX, 1);
+                emit.mov(host(0xF), RAX);
+                emit.shr(host(x), 1);
+                break;
+
+            case Kind::SUBN:
+                emit.alu(ALU_CMP, host(y), host(x));
+                emit.setccEax(CC_A);
+                emit.mov(host(0xF), RAX);
+                emit.mov(RAX, host(y));
+                emit.alu(ALU_SUB, RAX, host(x));
+                emit.aluImm(ALU_AND, RAX, 0xFF);
+                emit.mov(host(x), RAX);
+                break;
+
+            case Kind::SHL:
+                emit.mov(RAX, host(x));
+                emit.aluImm(ALU_AND, RAX, 0x80);
+                emit.mov(host(0xF), RAX);
+                emit.shl(host(x), 1);
+                emit.aluImm(ALU_AND, host(x), 0xFF);
+                break;
+
+            case Kind::LDI:
+                emit.movImm(host(GUEST_I), instruction.nnn);
+                break;
+
+            case Kind::ADD_I_V:
+                emit.alu(ALU_ADD, host(GUEST_I), host(x));
+                emit.aluImm(ALU_AND, host(GUEST_I), 0xFFFF);
+                break;
+
+            case Kind::SE:
+            case Kind::SNE: {
+                emit.aluImm(ALU_CMP, host(x), instruction.nn);
+                auto noSkip = emit.jcc(instruction.kind == Kind::SE ? CC_NE : CC_E);
+                emitExit(pc + INSTRUCTION_SIZE * 2);
+                emit.bind(noSkip);
+                emitExit(pc + INSTRUCTION_SIZE);
+                break;
+            }
+
+            case Kind::JP:
+                emitExit(instruction.nnn);
+                break;
+
+            default:
+                assert(false);
+                break;
+            }
+        }
+
+        if (!terminated) {
+            emitExit(pc);
+        }
+
+        if (!protect(m_codeUsed, MAX_BLOCK_BYTES, false)) {
+            release();
+            return;
+        }
+
+        block.code = reinterpret_cast<BlockFunction>(emit.begin());
+        block.length = static_cast<std::uint16_t>(length);
+        block.size = static_cast<std::uint16_t>(length * INSTRUCTION_SIZE);
+        block.state = BlockState::Compiled;
+
+        m_codeUsed += emit.size();
+        m_stats.blocksCompiled++;
+    }
+}
+
+#else
+
+namespace chip8
+{
+    Jit::Jit() = default;
+    Jit::~Jit() = default;
+
+    void Jit::flush()
+    {
+    }
+
+    void Jit::invalidate(std::uint16_t)
+    {
+    }
+
+    std::uint64_t Jit::execute(Chip8Context&, std::uint64_t)
+    {
+        return 0;
+    }
+
+    void Jit::compile(const Chip8Context&, std::uint16_t)
+    {
+    }
+}
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "chip8.h"
+
+// The recompiler emits x86-64 machine code into an mmap'd buffer, so it's only
+// built for x86-64 hosts with POSIX mmap. Everywhere else Core::Jit quietly
+// runs the threaded interpreter instead, as it does where the buffer can't be
+// mapped or flipped between writable and executable with mprotect (the
+// buffer is never both, so hosts that refuse W+X mappings are fine; a macOS
+// build with the hardened runtime would still need MAP_JIT and the allow-jit
+// entitlement, which it doesn't ask for).
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define CHIP8_JIT_SUPPORTED 1
+#else
+#define CHIP8_JIT_SUPPORTED 0
+#endif
+
+namespace chip8
+{
+    struct JitStats
+    {
+        std::uint64_t blocksCompiled = 0;
+        std::uint64_t blocksInvalidated = 0;
+        std::uint64_t flushes = 0;
+        std::uint64_t nativeInstructions = 0;
+        std::uint64_t interpretedInstructions = 0;
+    };
+
+    // Basic block recompiler for Chip8Context. A block is a straight run of
+    // register and ALU instructions, ended by a JP, SE or SNE (which become
+    // native branches) or by the first instruction the recompiler doesn't
+    // handle, which is left for the interpreter. The guest V registers and I
+    // used by a block live in host registers for its whole duration and PC is
+    // a compile-time constant, so guest state is only touched on entry and exit.
+    class Jit
+    {
+    public:
+        Jit();
+        ~Jit();
+
+        Jit(const Jit&) = delete;
+        Jit& operator=(const Jit&) = delete;
+
+        static bool isSupported()
+        {
+            return CHIP8_JIT_SUPPORTED != 0;
+        }
+
+        // Whether this instance has a code buffer to compile into. Without
+        // one, execute() always leaves the work to the interpreter.
+        bool isAvailable() const
+        {
+            return m_code != nullptr;
+        }
+
+        const JitStats& getStats() const
+        {
+            return m_stats;
+        }
+
+        // Runs the block starting at the context's PC if it fits in the given
+        // budget, compiling it first if needed. Returns the number of guest
+        // instructions executed, which is zero when the caller has to
+        // interpret the next instruction itself.
+        std::uint64_t execute(Chip8Context& context, std::uint64_t budget);
+
+        // Drops every block that covers the given guest address.
+        void invalidate(std::uint16_t address);
+
+        // Drops every block and recycles the code buffer.
+        void flush();
+
+        void countInterpreted(std::uint64_t count)
+        {
+            m_stats.interpretedInstructions += count;
+        }
+
+    private:
+        using BlockFunction = void(*)(void* registers);
+
+        enum class BlockState : std::uint8_t
+        {
+            Uncompiled,
+            Compiled,
+            Unsupported,
+        };
+
+        struct Block
+        {
+            BlockFunction code = nullptr;
+            std::uint16_t length = 0;
+            std::uint16_t size = 0;
+            BlockState state = BlockState::Uncompiled;
+        };
+
+        // Longest run of instructions compiled into a single block.
+        static const std::size_t MAX_BLOCK_LENGTH = 64;
+        static const std::size_t CODE_BUFFER_SIZE = 1 << 20;
+
+        std::array<Block, MEMORY_SIZE> m_blocks;
+        std::uint8_t* m_code = nullptr;
+        std::size_t m_codeUsed = 0;
+        JitStats m_stats;
+
+        void compile(const Chip8Context& context, std::uint16_t address);
+
+        // Switches the pages covering size bytes at offset into the code
+        // buffer to read/write or read/execute.
+        bool protect(std::size_t offset, std::size_t size, bool writable);
+
+        // Unmaps the code buffer for good, after it couldn't be protected.
+        void release();
+    };
+}
+
+#endif
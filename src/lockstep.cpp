@@ -0,0 +1,471 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "format.h"
+#include "lockstep.h"
+
+namespace
+{
+    using chip8::FramebufferRow;
+
+    FramebufferRow rotateRight(FramebufferRow value, unsigned count)
+    {
+        const unsigned bits = sizeof(value) * 8;
+        return (value >> count) | (value << ((bits - count) % bits));
+    }
+
+    // Calls body with the index of every lane set in mask, lowest first.
+    template<typename Mask, typename Body>
+    void forEachLane(Mask mask, Body body)
+    {
+        for (; mask != 0; mask &= mask - 1) {
+            body(static_cast<std::size_t>(__builtin_ctz(mask)));
+        }
+    }
+}
+
+namespace chip8
+{
+    template<std::size_t Lanes>
+    Lockstep<Lanes>::Lockstep()
+    {
+        m_PC.fill(INITIAL_PC);
+        m_stopReason.fill(StopReason::BudgetExhausted);
+
+        for (std::size_t address = 0; address < MEMORY_SIZE; address++) {
+            m_decoded[address] = decodeInstruction(0);
+        }
+    }
+
+    template<std::size_t Lanes>
+    void Lockstep<Lanes>::loadROM(const std::vector<std::uint8_t>& buffer)
+    {
+        if (buffer.size() > ROM_MAX_SIZE) {
+            fmt::print(stderr, "Warning: ROM size {} exceeds max size {}\n", buffer.size(), ROM_MAX_SIZE);
+        }
+
+        std::copy_n(buffer.cbegin(), std::min(buffer.size(), ROM_MAX_SIZE), m_memory.begin() + ROM_LOAD_ADDR);
+
+        // Nothing the guest can do writes to memory, so this is the only time
+        // it needs decoding. The last byte is the high byte of an instruction
+        // with a zero low byte, as in Chip8Context.
+        for (std::size_t address = 0; address < MEMORY_SIZE; address++) {
+            std::uint16_t raw = m_memory[address] << 8;
+            if (address + 1 < MEMORY_SIZE) {
+                raw |= m_memory[address + 1];
+            }
+
+            m_decoded[address] = decodeInstruction(raw);
+        }
+    }
+
+    template<std::size_t Lanes>
+    void Lockstep<Lanes>::saveState(std::size_t lane, State& state) const
+    {
+        for (std::size_t reg = 0; reg < NUM_GPRS; reg++) {
+            state.V[reg] = m_V[reg][lane];
+        }
+
+        state.I = m_I[lane];
+        state.PC = m_PC[lane];
+        state.DT = m_DT[lane];
+        state.ST = m_ST[lane];
+        state.SP = m_SP[lane];
+        state.keys = m_keys[lane];
+
+        for (std::size_t entry = 0; entry < STACK_SIZE; entry++) {
+            state.stack[entry] = m_stack[entry][lane];
+        }
+
+        state.random = m_random[lane].getState();
+        state.cycles = m_cycles[lane];
+        state.idleCycles = 0;
+        state.timerCountdown = 0;
+        state.resumeFromBreakpoint = 0;
+        state.framebuffer = m_framebuffer[lane];
+        state.memory = m_memory;
+    }
+
+    template<std::size_t Lanes>
+    void Lockstep<Lanes>::run(std::uint64_t count)
+    {
+        m_stopReason.fill(StopReason::BudgetExhausted);
+
+        // Budgets are counted down in 16 bits, the width of PC, so that all
+        // the per-step bookkeeping vectorises the same way.
+        while (count > 0) {
+            const auto chunk = static_cast<std::uint16_t>(std::min<std::uint64_t>(count, 0xFFFF));
+            count -= chunk;
+
+            Lane<std::uint16_t> remaining;
+            Lane<std::uint16_t> executed = {};
+
+            for (std::size_t lane = 0; lane < Lanes; lane++) {
+                remaining[lane] = m_stopReason[lane] == StopReason::BudgetExhausted ? chunk : 0;
+            }
+
+            while (true) {
+                // The group to run next is every lane on the lowest PC among
+                // those with budget left.
+                std::uint16_t pc = 0xFFFF;
+                std::uint16_t live = 0;
+
+                // Written without branches so that both loops vectorise. Lanes
+                // with no budget count as being at FFFF, which can't pick the
+                // wrong group: the select below leaves them out regardless.
+                for (std::size_t lane = 0; lane < Lanes; lane++) {
+                    const std::uint16_t candidate = m_PC[lane] | -static_cast<std::uint16_t>(remaining[lane] == 0);
+                    pc = candidate < pc ? candidate : pc;
+                    live |= remaining[lane];
+                }
+
+                if (live == 0) {
+                    break;
+                }
+
+                Lane<std::uint16_t> select;
+                for (std::size_t lane = 0; lane < Lanes; lane++) {
+                    select[lane] = -static_cast<std::uint16_t>(m_PC[lane] == pc) &
+                                   -static_cast<std::uint16_t>(remaining[lane] != 0);
+                }
+
+                for (std::size_t lane = 0; lane < Lanes; lane++) {
+                    remaining[lane] -= select[lane] & 1;
+                    executed[lane] += select[lane] & 1;
+                }
+
+                // Lanes waiting for a key or stopped by a stack fault didn't
+                // execute anything; ones that hit an unknown opcode did, as in
+                // Chip8Context.
+                const auto stopped = execute(pc, select);
+
+                forEachLane(stopped, [&](std::size_t lane) {
+                    remaining[lane] = 0;
+                    executed[lane] -= m_stopReason[lane] != StopReason::UnknownOpcode;
+                });
+
+                m_stats.steps++;
+            }
+
+            for (std::size_t lane = 0; lane < Lanes; lane++) {
+                m_cycles[lane] += executed[lane];
+                m_stats.laneInstructions += executed[lane];
+            }
+        }
+    }
+
+    template<std::size_t Lanes>
+    void Lockstep<Lanes>::runFrame(std::uint64_t cyclesPerFrame)
+    {
+        run(cyclesPerFrame);
+
+        for (std::size_t lane = 0; lane < Lanes; lane++) {
+            const std::uint8_t tick = m_stopReason[lane] == StopReason::BudgetExhausted ||
+                                      m_stopReason[lane] == StopReason::WaitForKey;
+
+            m_DT[lane] -= tick & (m_DT[lane] > 0);
+            m_ST[lane] -= tick & (m_ST[lane] > 0);
+        }
+    }
+
+    template<std::size_t Lanes>
+    typename Lockstep<Lanes>::Mask Lockstep<Lanes>::execute(std::uint16_t pc, Lane<std::uint16_t> select16)
+    {
+        using Kind = InstructionKind;
+
+        const auto& instruction = m_decoded[pc & (MEMORY_SIZE - 1)];
+        const auto nn = instruction.nn;
+        const auto nnn = instruction.nnn;
+        auto& Vx = m_V[instruction.x];
+        auto& Vy = m_V[instruction.y];
+        auto& VF = m_V[0xF];
+
+        // Lane-wide operations are branch free selects the compiler can
+        // vectorise. The few that have to go lane by lane, and stop lanes,
+        // build a bit mask of the group first.
+        Lane<std::uint8_t> select;
+        for (std::size_t lane = 0; lane < Lanes; lane++) {
+            select[lane] = static_cast<std::uint8_t>(select16[lane]);
+        }
+
+        auto getGroup = [&]() {
+            Mask group = 0;
+            for (std::size_t lane = 0; lane < Lanes; lane++) {
+                group |= static_cast<Mask>(select16[lane] & 1) << lane;
+            }
+            return group;
+        };
+
+        Mask stopped = 0;
+
+        // Results go through a local first so that the compiler can see the
+        // target never overlaps the operands, which may be the same register.
+        auto assign = [&](Lane<std::uint8_t>& target, auto value) {
+            Lane<std::uint8_t> result;
+            for (std::size_t lane = 0; lane < Lanes; lane++) {
+                result[lane] = value(lane);
+            }
+
+            for (std::size_t lane = 0; lane < Lanes; lane++) {
+                target[lane] = (target[lane] & ~select[lane]) | (result[lane] & select[lane]);
+            }
+        };
+
+        auto assign16 = [&](Lane<std::uint16_t>& target, auto value) {
+            Lane<std::uint16_t> result;
+            for (std::size_t lane = 0; lane < Lanes; lane++) {
+                result[lane] = value(lane);
+            }
+
+            for (std::size_t lane = 0; lane < Lanes; lane++) {
+                target[lane] = (target[lane] & ~select16[lane]) | (result[lane] & select16[lane]);
+            }
+        };
+
+        // Where each lane goes next, most instructions falling through. The
+        // group shares a PC, so conditional skips only pick between two.
+        const std::uint16_t fallThrough = pc + INSTRUCTION_SIZE;
+        const std::uint16_t skip = pc + INSTRUCTION_SIZE * 2;
+        Lane<std::uint16_t> next;
+        next.fill(fallThrough);
+
+        auto skipIf = [&](auto condition) {
+            for (std::size_t lane = 0; lane < Lanes; lane++) {
+                next[lane] = condition(lane) ? skip : fallThrough;
+            }
+        };
+
+        switch (instruction.kind) {
+        case Kind::CLS:
+            forEachLane(getGroup(), [&](std::size_t lane) { clearScreen(lane); });
+            break;
+
+        case Kind::RET:
+            forEachLane(getGroup(), [&](std::size_t lane) {
+                if (m_SP[lane] == 0) {
+                    if (!handleStackFault(lane, pc, false)) {
+                        stopped |= Mask(1) << lane;
+                        next[lane] = pc;
+                        return;
+                    }
+
+                    m_SP[lane] = STACK_SIZE;
+                }
+
+                next[lane] = m_stack[--m_SP[lane]][lane];
+            });
+            break;
+
+        case Kind::JP:
+            next.fill(nnn);
+            break;
+
+        case Kind::CALL:
+            next.fill(nnn);
+            forEachLane(getGroup(), [&](std::size_t lane) {
+                if (m_SP[lane] == STACK_SIZE) {
+                    if (!handleStackFault(lane, pc, true)) {
+                        stopped |= Mask(1) << lane;
+                        next[lane] = pc;
+                        return;
+                    }
+
+                    m_SP[lane] = 0;
+                }
+
+                m_stack[m_SP[lane]++][lane] = fallThrough;
+            });
+            break;
+
+        case Kind::SE:
+            skipIf([&](std::size_t lane) { return Vx[lane] == nn; });
+            break;
+
+        case Kind::SNE:
+            skipIf([&](std::size_t lane) { return Vx[lane] != nn; });
+            break;
+
+        case Kind::LD:
+            assign(Vx, [&](std::size_t) { return nn; });
+            break;
+
+        case Kind::ADD:
+            assign(Vx, [&](std::size_t lane) { return Vx[lane] + nn; });
+            break;
+
+        case Kind::LD_VV:
+            assign(Vx, [&](std::size_t lane) { return Vy[lane]; });
+            break;
+
+        case Kind::OR:
+            assign(Vx, [&](std::size_t lane) { return Vx[lane] | Vy[lane]; });
+            break;
+
+        case Kind::AND:
+            assign(Vx, [&](std::size_t lane) { return Vx[lane] & Vy[lane]; });
+            break;
+
+        case Kind::XOR:
+            assign(Vx, [&](std::size_t lane) { return Vx[lane] ^ Vy[lane]; });
+            break;
+
+        // The flag is written before the result, and the sum read before
+        // either, exactly as the scalar handlers order them; it matters when
+        // x or y is F.
+        case Kind::ADD_VV: {
+            Lane<std::uint16_t> sum;
+            for (std::size_t lane = 0; lane < Lanes; lane++) {
+                sum[lane] = Vx[lane] + Vy[lane];
+            }
+
+            assign(VF, [&](std::size_t lane) { return (sum[lane] & 0xFF00) ? 1 : 0; });
+            assign(Vx, [&](std::size_t lane) { return sum[lane]; });
+            break;
+        }
+
+        case Kind::SUB:
+            assign(VF, [&](std::size_t lane) { return Vx[lane] > Vy[lane] ? 1 : 0; });
+            assign(Vx, [&](std::size_t lane) { return Vx[lane] - Vy[lane]; });
+            break;
+
+        case Kind::SHR:
+            assign(VF, [&](std::size_t lane) { return Vx[lane] & 1; });
+            assign(Vx, [&](std::size_t lane) { return Vx[lane] >> 1; });
+            break;
+
+        case Kind::SUBN:
+            assign(VF, [&](std::size_t lane) { return Vy[lane] > Vx[lane] ? 1 : 0; });
+            assign(Vx, [&](std::size_t lane) { return Vy[lane] - Vx[lane]; });
+            break;
+
+        case Kind::SHL:
+            assign(VF, [&](std::size_t lane) { return Vx[lane] & 0x80; });
+            assign(Vx, [&](std::size_t lane) { return Vx[lane] << 1; });
+            break;
+
+        case Kind::LDI:
+            assign16(m_I, [&](std::size_t) { return nnn; });
+            break;
+
+        case Kind::RND:
+            forEachLane(getGroup(), [&](std::size_t lane) { Vx[lane] = m_random[lane].next() & nn; });
+            break;
+
+        case Kind::DRW:
+            forEachLane(getGroup(), [&](std::size_t lane) { drawSprite(lane, Vx[lane], Vy[lane], instruction.n); });
+            break;
+
+        case Kind::LD_V_DT:
+            assign(Vx, [&](std::size_t lane) { return m_DT[lane]; });
+            break;
+
+        case Kind::LD_DT_V:
+            assign(m_DT, [&](std::size_t lane) { return Vx[lane]; });
+            break;
+
+        case Kind::LD_ST_V:
+            assign(m_ST, [&](std::size_t lane) { return Vx[lane]; });
+            break;
+
+        case Kind::ADD_I_V:
+            assign16(m_I, [&](std::size_t lane) { return m_I[lane] + Vx[lane]; });
+            break;
+
+        case Kind::SKP:
+            skipIf([&](std::size_t lane) { return (m_keys[lane] >> (Vx[lane] & 0xF)) & 1; });
+            break;
+
+        case Kind::SKNP:
+            skipIf([&](std::size_t lane) { return !((m_keys[lane] >> (Vx[lane] & 0xF)) & 1); });
+            break;
+
+        case Kind::LD_V_K:
+            forEachLane(getGroup(), [&](std::size_t lane) {
+                if (m_keys[lane] == 0) {
+                    m_stopReason[lane] = StopReason::WaitForKey;
+                    stopped |= Mask(1) << lane;
+                    next[lane] = pc;
+                } else {
+                    // The lowest numbered key that's held down.
+                    Vx[lane] = static_cast<std::uint8_t>(__builtin_ctz(m_keys[lane]));
+                }
+            });
+            break;
+
+        default:
+            // Unknown instructions step over themselves and stop the lane.
+            stopped = getGroup();
+            forEachLane(stopped, [&](std::size_t lane) { m_stopReason[lane] = StopReason::UnknownOpcode; });
+            break;
+        }
+
+        assign16(m_PC, [&](std::size_t lane) { return next[lane]; });
+
+        return stopped;
+    }
+
+    template<std::size_t Lanes>
+    bool Lockstep<Lanes>::handleStackFault(std::size_t lane, std::uint16_t pc, bool overflow)
+    {
+        switch (m_stackPolicy) {
+        case StackPolicy::Wrap:
+            return true;
+
+        case StackPolicy::Trap:
+            m_stopReason[lane] = StopReason::StackFault;
+            return false;
+
+        case StackPolicy::Abort:
+            break;
+        }
+
+        fmt::print(stderr, "E: Stack {} at {:#04x} in lane {}\n", overflow ? "overflow" : "underflow", pc, lane);
+        std::abort();
+    }
+
+    template<std::size_t Lanes>
+    void Lockstep<Lanes>::drawSprite(std::size_t lane, std::uint8_t x, std::uint8_t y, std::uint8_t rows)
+    {
+        auto& framebuffer = m_framebuffer[lane];
+        const auto shift = x % FRAMEBUFFER_WIDTH;
+        FramebufferRow collisions = 0;
+        bool changed = false;
+
+        for (auto i = 0; i < rows; i++) {
+            const FramebufferRow sprite = m_memory[(m_I[lane] + i) & (MEMORY_SIZE - 1)];
+            const auto bits = rotateRight(sprite << (FRAMEBUFFER_WIDTH - 8), shift);
+            auto& row = framebuffer[(y + i) % FRAMEBUFFER_HEIGHT];
+
+            collisions |= row & bits;
+            row ^= bits;
+            changed |= bits != 0;
+        }
+
+        m_V[0xF][lane] = collisions != 0 ? 1 : 0;
+
+        if (changed) {
+            m_framebufferGeneration[lane]++;
+        }
+    }
+
+    template<std::size_t Lanes>
+    void Lockstep<Lanes>::clearScreen(std::size_t lane)
+    {
+        bool changed = false;
+
+        for (auto& row : m_framebuffer[lane]) {
+            changed |= row != 0;
+            row = 0;
+        }
+
+        if (changed) {
+            m_framebufferGeneration[lane]++;
+        }
+    }
+
+    template class Lockstep<8>;
+    template class Lockstep<16>;
+    template class Lockstep<32>;
+}
@@ -0,0 +1,218 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "chip8.h"
+
+namespace chip8
+{
+    struct LockstepStats
+    {
+        // Groups of lanes executed together, and the lane instructions they
+        // added up to.
+        std::uint64_t steps = 0;
+        std::uint64_t laneInstructions = 0;
+
+        // Fraction of lane slots that did useful work, 1 when every lane
+        // always agreed on PC.
+        double getUtilisation(std::size_t lanes) const
+        {
+            return steps ? static_cast<double>(laneInstructions) / (steps * lanes) : 0.0;
+        }
+    };
+
+    // Runs the same ROM in Lanes independent machines at once. Registers,
+    // timers, stacks and keypads are kept as structures of arrays with a
+    // lane per element, so an instruction is fetched and decoded once and
+    // applied to every lane whose PC is on it with plain loops over the
+    // lanes, which the compiler turns into vector code. Lanes whose PCs
+    // differ are run as separate groups, lowest PC first so that lanes that
+    // fall behind get the chance to catch back up.
+    //
+    // Each lane behaves exactly like a Chip8Context running the same ROM on
+    // its own with no breakpoints and timers stepped by runFrame(), and
+    // reports the same cycle counts (idle loops are always executed rather
+    // than skipped, which only costs time). Unknown opcodes stop their lane
+    // without printing anything.
+    template<std::size_t Lanes>
+    class Lockstep
+    {
+        static_assert(Lanes >= 1 && Lanes <= 32, "A lane mask has to fit in 32 bits");
+
+    public:
+        using Mask = std::uint32_t;
+
+        static const Mask ALL_LANES = static_cast<Mask>((std::uint64_t(1) << Lanes) - 1);
+
+        Lockstep();
+
+        // Loads the ROM into the memory shared by every lane.
+        void loadROM(const std::vector<std::uint8_t>& buffer);
+
+        std::uint8_t getV(std::size_t lane, std::size_t reg) const
+        {
+            return m_V[reg][lane];
+        }
+
+        void setV(std::size_t lane, std::size_t reg, std::uint8_t value)
+        {
+            m_V[reg][lane] = value;
+        }
+
+        std::uint16_t getI(std::size_t lane) const
+        {
+            return m_I[lane];
+        }
+
+        void setI(std::size_t lane, std::uint16_t value)
+        {
+            m_I[lane] = value;
+        }
+
+        std::uint16_t getPC(std::size_t lane) const
+        {
+            return m_PC[lane];
+        }
+
+        void setPC(std::size_t lane, std::uint16_t value)
+        {
+            m_PC[lane] = value;
+        }
+
+        std::uint8_t getDelayTimer(std::size_t lane) const
+        {
+            return m_DT[lane];
+        }
+
+        void setDelayTimer(std::size_t lane, std::uint8_t value)
+        {
+            m_DT[lane] = value;
+        }
+
+        std::uint8_t getSoundTimer(std::size_t lane) const
+        {
+            return m_ST[lane];
+        }
+
+        void setSoundTimer(std::size_t lane, std::uint8_t value)
+        {
+            m_ST[lane] = value;
+        }
+
+        std::uint16_t getKeys(std::size_t lane) const
+        {
+            return m_keys[lane];
+        }
+
+        void setKeys(std::size_t lane, std::uint16_t keys)
+        {
+            m_keys[lane] = keys;
+        }
+
+        void seedRandom(std::size_t lane, std::uint32_t seed)
+        {
+            m_random[lane].seed(seed);
+        }
+
+        const Framebuffer& getFramebufferRows(std::size_t lane) const
+        {
+            return m_framebuffer[lane];
+        }
+
+        std::uint64_t getFramebufferGeneration(std::size_t lane) const
+        {
+            return m_framebufferGeneration[lane];
+        }
+
+        std::uint64_t getCycles(std::size_t lane) const
+        {
+            return m_cycles[lane];
+        }
+
+        // Why the lane stopped in the last run().
+        StopReason getStopReason(std::size_t lane) const
+        {
+            return m_stopReason[lane];
+        }
+
+        StackPolicy getStackPolicy() const
+        {
+            return m_stackPolicy;
+        }
+
+        // Applies to every lane. Trap by default, as in Chip8Context.
+        void setStackPolicy(StackPolicy policy)
+        {
+            m_stackPolicy = policy;
+        }
+
+        const LockstepStats& getStats() const
+        {
+            return m_stats;
+        }
+
+        // Copies one lane's machine state into state, as if it had been run
+        // by a Chip8Context, so lanes can be checked against one or handed
+        // over to one with loadState(). Idle cycles are always zero.
+        void saveState(std::size_t lane, State& state) const;
+
+        // Runs up to count instructions in every lane, each stopping early
+        // for the same reasons Chip8Context::run() would.
+        void run(std::uint64_t count);
+
+        // Runs a frame in every lane, then steps the timers of each lane that
+        // wasn't stopped by an unknown opcode.
+        void runFrame(std::uint64_t cyclesPerFrame);
+
+    private:
+        // One value per lane. The ones the vector loops work on are aligned
+        // for the widest vectors the host might have.
+        template<typename T>
+        using Lane = std::array<T, Lanes>;
+
+        static const std::size_t VECTOR_ALIGNMENT = 32;
+
+        std::array<std::uint8_t, MEMORY_SIZE> m_memory = {{ 0 }};
+        std::array<Instruction, MEMORY_SIZE> m_decoded;
+
+        alignas(VECTOR_ALIGNMENT) std::array<Lane<std::uint8_t>, NUM_GPRS> m_V = {};
+        alignas(VECTOR_ALIGNMENT) Lane<std::uint16_t> m_I = {};
+        alignas(VECTOR_ALIGNMENT) Lane<std::uint16_t> m_PC = {};
+        alignas(VECTOR_ALIGNMENT) Lane<std::uint8_t> m_DT = {};
+        alignas(VECTOR_ALIGNMENT) Lane<std::uint8_t> m_ST = {};
+        alignas(VECTOR_ALIGNMENT) Lane<std::uint8_t> m_SP = {};
+        alignas(VECTOR_ALIGNMENT) std::array<Lane<std::uint16_t>, STACK_SIZE> m_stack = {};
+        alignas(VECTOR_ALIGNMENT) Lane<std::uint16_t> m_keys = {};
+
+        Lane<Random> m_random;
+        Lane<Framebuffer> m_framebuffer = {};
+        Lane<std::uint64_t> m_framebufferGeneration = {};
+        Lane<std::uint64_t> m_cycles = {};
+        Lane<StopReason> m_stopReason = {};
+
+        StackPolicy m_stackPolicy = StackPolicy::Trap;
+        LockstepStats m_stats;
+
+        // Executes the instruction at pc in the lanes selected (all ones) in
+        // select, all of which are on it. Returns the lanes it stopped, with
+        // their stop reasons set. select is taken by value so the compiler
+        // knows it can't alias the registers.
+        Mask execute(std::uint16_t pc, Lane<std::uint16_t> select);
+
+        // As Chip8Context::handleStackFault(), for one lane.
+        bool handleStackFault(std::size_t lane, std::uint16_t pc, bool overflow);
+
+        void drawSprite(std::size_t lane, std::uint8_t x, std::uint8_t y, std::uint8_t rows);
+        void clearScreen(std::size_t lane);
+    };
+
+    extern template class Lockstep<8>;
+    extern template class Lockstep<16>;
+    extern template class Lockstep<32>;
+}
+
+#endif
@@ -1,49 +1,496 @@
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <ctime>
-#include <experimental/filesystem>
 #include <fstream>
+#include <functional>
+#include <cstring>
 #include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
 #include <SDL2/SDL.h>
 
 #include "format.h"
 #include "chip8.h"
-
-namespace fs = std::experimental::filesystem;
+#include "cli.h"
+#include "expand.h"
+#include "movie.h"
+#include "pacer.h"
+#include "rewind.h"
+#include "sync.h"
 
 static const int WINDOW_WIDTH = 1280;
 static const int WINDOW_HEIGHT = 720;
 
-static bool loadROM(chip8::Chip8Context* context, const char* path)
+static const std::uint64_t CYCLES_PER_FRAME = chip8::DEFAULT_CYCLES_PER_FRAME;
+
+// Used when SDL can't tell what the display runs at.
+static const int DEFAULT_REFRESH_RATE = 60;
+
+// Key state changes that can be queued up before the emulation thread gets
+// to them.
+static const std::size_t INPUT_QUEUE_SIZE = 64;
+
+// Seconds of history kept for rewinding by default.
+static const std::uint64_t DEFAULT_REWIND_SECONDS = 60;
+
+// Held to step back through the history a frame at a time.
+static const SDL_Scancode REWIND_KEY = SDL_SCANCODE_BACKSPACE;
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    const char* romPath = nullptr;
+    const char* recordPath = nullptr;
+    std::uint64_t cyclesPerFrame = CYCLES_PER_FRAME;
+    std::uint64_t frames = 0;
+    std::uint64_t rewindSeconds = DEFAULT_REWIND_SECONDS;
+    std::uint64_t runAhead = 0;
+    chip8::Palette palette = chip8::DEFAULT_PALETTE;
+    bool vsync = false;
+    bool unthrottled = false;
+    bool streaming = true;
+};
+
+// What the emulation thread publishes at the end of every frame. Each one
+// is a complete copy, as the render thread may skip any number of them.
+struct FrameSnapshot
+{
+    chip8::Framebuffer framebuffer = {{ 0 }};
+    std::uint64_t generation = 0;
+    std::uint64_t cycles = 0;
+    std::uint64_t frames = 0;
+
+    // The rewind buffer's contents and its running encode totals.
+    std::size_t rewindFrames = 0;
+    std::size_t rewindBytes = 0;
+    std::uint64_t rewindEncodes = 0;
+    Clock::duration rewindEncodeTime = Clock::duration::zero();
+
+    // Running totals for run-ahead: time spent on real frames and on the
+    // speculative ones (with saving and restoring), and how many of the
+    // speculative frames shown turned out to match the real frame when it
+    // came.
+    Clock::duration emulationTime = Clock::duration::zero();
+    Clock::duration runAheadTime = Clock::duration::zero();
+    std::uint64_t predictions = 0;
+    std::uint64_t confirmed = 0;
+};
+
+// Shared between the render thread, which owns SDL, and the emulation
+// thread, which owns the context. Frames flow one way and keypad states the
+// other, neither side ever waiting on the other.
+struct Emulation
+{
+    chip8::TripleBuffer<FrameSnapshot> frames;
+    chip8::SpscQueue<std::uint16_t, INPUT_QUEUE_SIZE> keys;
+    std::atomic<bool> rewinding{ false };
+    std::atomic<bool> stop{ false };
+    std::atomic<bool> finished{ false };
+};
+
+// What's been uploaded to the texture so far. A streaming texture is
+// expanded into straight from the snapshot while it's locked; a static one
+// is updated from a copy kept here. Either way only the rows that differ
+// from the last upload are expanded again.
+struct TextureState
+{
+    bool streaming;
+    std::array<std::uint32_t, chip8::FRAMEBUFFER_SIZE> pixels = {{ 0 }};
+    chip8::Framebuffer rows = {{ 0 }};
+    std::optional<std::uint64_t> generation;
+};
+
+// Counters for the once a second performance report. Cycles and frames are
+// the emulation thread's totals as of the start of the period.
+struct Statistics
 {
-    auto romPath = fs::path(path);
+    Clock::time_point start = Clock::now();
+    std::uint64_t cycles = 0;
+    std::uint64_t frames = 0;
+    std::uint64_t presents = 0;
+    std::uint64_t uploads = 0;
+    Clock::duration uploadTime = Clock::duration::zero();
+    std::uint64_t rewindEncodes = 0;
+    Clock::duration rewindEncodeTime = Clock::duration::zero();
+    Clock::duration emulationTime = Clock::duration::zero();
+    Clock::duration runAheadTime = Clock::duration::zero();
+    std::uint64_t predictions = 0;
+    std::uint64_t confirmed = 0;
+};
+
+// The usual mapping of the COSMAC VIP hex keypad onto the left of a QWERTY
+// keyboard, indexed by CHIP-8 key.
+static const std::array<SDL_Scancode, chip8::NUM_KEYS> KEY_MAP = {{
+    SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3,
+    SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A,
+    SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C,
+    SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V,
+}};
 
-    if (!fs::exists(romPath)) {
+static bool loadROM(chip8::Chip8Context* context, const char* path, std::vector<std::uint8_t>& buffer)
+{
+    if (!chip8::readFile(path, buffer)) {
         return false;
     }
 
-    auto romSize = fs::file_size(path);
-    std::vector<std::uint8_t> buffer(romSize);
+    context->loadROM(buffer);
 
-    std::ifstream file(romPath, std::ios::binary);
-    file.read(reinterpret_cast<char*>(buffer.data()), romSize);
+    return true;
+}
 
-    context->loadROM(buffer);
+// Returns whether anything was uploaded.
+static bool copyFramebuffer(const FrameSnapshot& snapshot, SDL_Texture* texture, TextureState& state,
+                            const chip8::Palette& palette)
+{
+    if (state.generation == snapshot.generation) {
+        return false;
+    }
+
+    // Snapshots in between may have been skipped, so the context's dirty rows
+    // are no use here; comparing against the last upload is just as cheap.
+    // The first upload has to fill the whole texture.
+    const auto& rows = snapshot.framebuffer;
+    chip8::DirtyRows dirty = 0;
+
+    for (std::size_t y = 0; y < chip8::FRAMEBUFFER_HEIGHT; y++) {
+        if (!state.generation || rows[y] != state.rows[y]) {
+            dirty |= chip8::DirtyRows(1) << y;
+        }
+    }
+
+    state.generation = snapshot.generation;
+
+    if (dirty == 0) {
+        return false;
+    }
+
+    std::size_t first = 0;
+    while (!((dirty >> first) & 1)) {
+        first++;
+    }
+
+    std::size_t last = chip8::FRAMEBUFFER_HEIGHT - 1;
+    while (!((dirty >> last) & 1)) {
+        last--;
+    }
+
+    // Clean rows in between are cheap enough to expand again, and locked
+    // texture memory is write-only so they'd have to be anyway.
+    const auto count = last - first + 1;
+
+    SDL_Rect rect;
+    rect.x = 0;
+    rect.y = static_cast<int>(first);
+    rect.w = chip8::FRAMEBUFFER_WIDTH;
+    rect.h = static_cast<int>(count);
+
+    if (state.streaming) {
+        void* pixels;
+        int pitch;
+
+        if (SDL_LockTexture(texture, &rect, &pixels, &pitch) < 0) {
+            fmt::print("Couldn't lock texture: {}\n", SDL_GetError());
+            state.generation.reset();
+            return false;
+        }
+
+        chip8::expandRows(&rows[first], count, static_cast<std::uint32_t*>(pixels),
+                          pitch / sizeof(std::uint32_t), palette);
+
+        SDL_UnlockTexture(texture);
+    } else {
+        auto pixels = &state.pixels[first * chip8::FRAMEBUFFER_WIDTH];
+        chip8::expandRows(&rows[first], count, pixels, chip8::FRAMEBUFFER_WIDTH, palette);
+
+        SDL_UpdateTexture(texture, &rect, pixels, chip8::FRAMEBUFFER_WIDTH * sizeof(std::uint32_t));
+    }
+
+    state.rows = rows;
 
     return true;
 }
 
-static void copyFramebuffer(chip8::Chip8Context* context, SDL_Texture* texture)
+// Updates keys, one bit per CHIP-8 key, and whether the rewind key is held.
+// Returns false once the window has been closed.
+static bool handleEvents(std::uint16_t& keys, bool& rewinding)
+{
+    SDL_Event event;
+
+    while (SDL_PollEvent(&event)) {
+        switch (event.type) {
+        case SDL_QUIT:
+            return false;
+
+        case SDL_KEYDOWN:
+        case SDL_KEYUP: {
+            if (event.key.keysym.scancode == REWIND_KEY) {
+                rewinding = event.type == SDL_KEYDOWN;
+                break;
+            }
+
+            auto key = std::find(KEY_MAP.cbegin(), KEY_MAP.cend(), event.key.keysym.scancode);
+            if (key != KEY_MAP.cend()) {
+                const auto bit = std::uint16_t(1) << (key - KEY_MAP.cbegin());
+                keys = event.type == SDL_KEYDOWN ? keys | bit : keys & ~bit;
+            }
+            break;
+        }
+        }
+    }
+
+    return true;
+}
+
+// Body of the emulation thread: runs frames at the pace of its own pacer
+// until told to stop or the frame limit is reached, publishing each one.
+// While rewinding it steps back through the history instead, at the same
+// pace, and carries on from wherever it's let go. Frames rewound over are
+// dropped from the movie too, if one's being recorded.
+//
+// With run-ahead, each real frame is followed by saving the state, running
+// that many more with the same keys held, publishing the result and
+// restoring the state. Input then shows up on screen that many frames
+// sooner, whenever the ROM would have reacted to it within them.
+static void runEmulation(chip8::Chip8Context* context, Emulation& emulation, const Options& options,
+                         chip8::Movie* movie)
+{
+    std::unique_ptr<chip8::RewindBuffer> rewind;
+    if (options.rewindSeconds > 0) {
+        rewind = std::make_unique<chip8::RewindBuffer>(options.rewindSeconds * chip8::TIMER_FREQUENCY);
+    }
+
+    chip8::State state;
+
+    // What each of the last runAhead speculative frames showed, indexed by
+    // the real frame it stood in for modulo runAhead, to check against it.
+    // Only ones made since speculating last started are any use.
+    chip8::State runAheadState;
+    std::vector<chip8::Framebuffer> predicted(options.runAhead);
+    std::uint64_t realFrames = 0;
+    std::uint64_t firstPrediction = 1;
+
+    Clock::duration emulationTime = Clock::duration::zero();
+    Clock::duration runAheadTime = Clock::duration::zero();
+    std::uint64_t predictions = 0;
+    std::uint64_t confirmed = 0;
+
+    std::unique_ptr<chip8::Pacer> pacer;
+    if (options.unthrottled) {
+        pacer = std::make_unique<chip8::UnthrottledPacer>();
+    } else {
+        pacer = std::make_unique<chip8::RealTimePacer>();
+    }
+
+    std::uint16_t keys = 0;
+
+    for (std::uint64_t frame = 0; options.frames == 0 || frame < options.frames; frame++) {
+        if (emulation.stop.load(std::memory_order_relaxed)) {
+            break;
+        }
+
+        // A key pressed and released since the last frame is still held for
+        // this one, so that quick taps aren't lost.
+        std::uint16_t queued;
+        std::uint16_t seen = keys;
+
+        while (emulation.keys.pop(queued)) {
+            seen |= queued;
+            keys = queued;
+        }
+
+        context->setKeys(seen);
+
+        auto& snapshot = emulation.frames.back();
+        bool speculated = false;
+
+        // At the oldest frame there's nothing to do but hold it.
+        if (rewind && emulation.rewinding.load(std::memory_order_relaxed)) {
+            firstPrediction = realFrames + 1;
+
+            if (rewind->stepBack(state)) {
+                context->loadState(state);
+
+                if (movie) {
+                    chip8::truncateMovie(*movie, movie->keys.size() - 1);
+                }
+            }
+        } else {
+            auto start = Clock::now();
+            context->runFrame(options.cyclesPerFrame);
+            emulationTime += Clock::now() - start;
+            realFrames++;
+
+            if (rewind) {
+                rewind->push(*context);
+            }
+
+            if (movie) {
+                chip8::recordFrame(*movie, seen, *context);
+            }
+
+            if (options.runAhead > 0) {
+                auto& prediction = predicted[realFrames % options.runAhead];
+
+                if (realFrames >= firstPrediction + options.runAhead) {
+                    predictions++;
+                    confirmed += prediction == context->getFramebufferRows();
+                }
+
+                start = Clock::now();
+                context->saveState(runAheadState);
+
+                for (std::uint64_t ahead = 0; ahead < options.runAhead; ahead++) {
+                    context->runFrame(options.cyclesPerFrame);
+                }
+
+                prediction = context->getFramebufferRows();
+                snapshot.framebuffer = prediction;
+                snapshot.generation = context->getFramebufferGeneration();
+
+                // Restoring bumps the generation, so a speculative frame's
+                // can never come round again for different contents.
+                context->loadState(runAheadState);
+                runAheadTime += Clock::now() - start;
+                speculated = true;
+            }
+        }
+
+        if (!speculated) {
+            snapshot.framebuffer = context->getFramebufferRows();
+            snapshot.generation = context->getFramebufferGeneration();
+        }
+
+        snapshot.cycles = context->getCycles();
+        snapshot.frames = frame + 1;
+
+        if (rewind) {
+            const auto& stats = rewind->getStats();
+            snapshot.rewindFrames = rewind->size();
+            snapshot.rewindBytes = rewind->getMemoryUsage();
+            snapshot.rewindEncodes = stats.frames;
+            snapshot.rewindEncodeTime = stats.encodeTime;
+        }
+
+        snapshot.emulationTime = emulationTime;
+        snapshot.runAheadTime = runAheadTime;
+        snapshot.predictions = predictions;
+        snapshot.confirmed = confirmed;
+
+        emulation.frames.publish();
+
+        pacer->endFrame();
+    }
+
+    emulation.finished.store(true, std::memory_order_release);
+}
+
+static bool parseOptions(int argc, char* argv[], Options& options)
 {
-    const auto& framebuffer = context->getFramebuffer();
-    std::vector<std::uint32_t> pixels(framebuffer.size());
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const bool hasValue = i + 1 < argc;
 
-    std::transform(framebuffer.cbegin(), framebuffer.cend(), pixels.begin(),
-                   [](auto pixel) { return pixel ? 0xFFFFFFFF : 0; });
+        if (std::strcmp(arg, "--vsync") == 0) {
+            options.vsync = true;
+        } else if (std::strcmp(arg, "--unthrottled") == 0) {
+            options.unthrottled = true;
+        } else if (std::strcmp(arg, "--static-texture") == 0) {
+            options.streaming = false;
+        } else if (std::strcmp(arg, "--cycles") == 0 && hasValue) {
+            options.cyclesPerFrame = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(arg, "--frames") == 0 && hasValue) {
+            options.frames = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(arg, "--record") == 0 && hasValue) {
+            options.recordPath = argv[++i];
+        } else if (std::strcmp(arg, "--run-ahead") == 0 && hasValue) {
+            options.runAhead = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(arg, "--rewind") == 0 && hasValue) {
+            options.rewindSeconds = std::strtoull(argv[++i], nullptr, 0);
+        } else if (std::strcmp(arg, "--foreground") == 0 && hasValue) {
+            options.palette.foreground = std::strtoul(argv[++i], nullptr, 16);
+        } else if (std::strcmp(arg, "--background") == 0 && hasValue) {
+            options.palette.background = std::strtoul(argv[++i], nullptr, 16);
+        } else if (arg[0] != '-' && !options.romPath) {
+            options.romPath = arg;
+        } else {
+            return false;
+        }
+    }
 
-    SDL_UpdateTexture(texture, nullptr, pixels.data(), chip8::FRAMEBUFFER_WIDTH * sizeof(std::uint32_t));
+    return options.romPath != nullptr && options.cyclesPerFrame > 0;
+}
+
+static unsigned getRefreshRate(SDL_Window* window)
+{
+    SDL_DisplayMode mode;
+
+    if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) == 0 && mode.refresh_rate > 0) {
+        return static_cast<unsigned>(mode.refresh_rate);
+    }
+
+    return DEFAULT_REFRESH_RATE;
+}
+
+static void reportStatistics(const FrameSnapshot& latest, Statistics& statistics, Clock::time_point now,
+                             const Options& options)
+{
+    std::chrono::duration<double> elapsed = now - statistics.start;
+    if (elapsed < std::chrono::seconds(1)) {
+        return;
+    }
+
+    const auto cycles = latest.cycles - statistics.cycles;
+    const auto frames = latest.frames - statistics.frames;
+
+    std::chrono::duration<double, std::micro> uploadTime = statistics.uploadTime;
+    const auto uploadAverage = statistics.uploads ? uploadTime.count() / statistics.uploads : 0.0;
+
+    fmt::print("{:.0f} instructions/s, {:.1f} frames/s, {:.1f} presents/s, {:.2f} us/upload",
+               cycles / elapsed.count(), frames / elapsed.count(),
+               statistics.presents / elapsed.count(), uploadAverage);
+
+    if (latest.rewindFrames > 0) {
+        const auto encodes = latest.rewindEncodes - statistics.rewindEncodes;
+        std::chrono::duration<double, std::micro> encodeTime = latest.rewindEncodeTime - statistics.rewindEncodeTime;
+
+        fmt::print(", rewind {:.1f} s in {:.0f} KB, {:.2f} us/encode",
+                   static_cast<double>(latest.rewindFrames) / chip8::TIMER_FREQUENCY, latest.rewindBytes / 1024.0,
+                   encodes ? encodeTime.count() / encodes : 0.0);
+    }
+
+    if (latest.runAheadTime > statistics.runAheadTime) {
+        std::chrono::duration<double> emulationTime = latest.emulationTime - statistics.emulationTime;
+        std::chrono::duration<double> runAheadTime = latest.runAheadTime - statistics.runAheadTime;
+        std::chrono::duration<double, std::micro> perFrame = runAheadTime / std::max<std::uint64_t>(frames, 1);
+
+        const auto predictions = latest.predictions - statistics.predictions;
+        const auto confirmed = predictions ? static_cast<double>(latest.confirmed - statistics.confirmed) / predictions : 0.0;
+
+        // Only a speculative frame that matched the real one showed it any
+        // sooner.
+        fmt::print(", run-ahead {:.1f} us/frame (+{:.0f}% CPU), {:.0f}% confirmed, {:.1f} ms sooner",
+                   perFrame.count(), runAheadTime / emulationTime * 100, confirmed * 100,
+                   confirmed * options.runAhead * 1000.0 / chip8::TIMER_FREQUENCY);
+    }
+
+    fmt::print("\n");
+
+    statistics = Statistics();
+    statistics.start = now;
+    statistics.cycles = latest.cycles;
+    statistics.frames = latest.frames;
+    statistics.rewindEncodes = latest.rewindEncodes;
+    statistics.rewindEncodeTime = latest.rewindEncodeTime;
+    statistics.emulationTime = latest.emulationTime;
+    statistics.runAheadTime = latest.runAheadTime;
+    statistics.predictions = latest.predictions;
+    statistics.confirmed = latest.confirmed;
 }
 
 static SDL_Rect computeDrawRect(int width, int height)
@@ -74,14 +521,28 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    if (argc < 2) {
-        fmt::print("Usage: {} <path to ROM>\n", argv[0]);
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        fmt::print("Usage: {} [options] <path to ROM>\n"
+                   "  --cycles N      instructions per 60 Hz frame (default {})\n"
+                   "  --frames N      quit after N frames\n"
+                   "  --record F      record a movie of the session to F, for chip8-headless --replay\n"
+                   "  --run-ahead N   show each frame N frames early, to hide input lag (default 0)\n"
+                   "  --rewind S      seconds of history to step back through with Backspace, 0 for none (default {})\n"
+                   "  --foreground C  lit pixel colour as RRGGBBAA hex (default {:08x})\n"
+                   "  --background C  unlit pixel colour as RRGGBBAA hex (default {:08x})\n"
+                   "  --vsync         wait for the display's vertical blank when presenting\n"
+                   "  --unthrottled   emulate as fast as possible, still presenting once per display refresh\n"
+                   "  --static-texture  upload with SDL_UpdateTexture instead of locking a streaming texture\n",
+                   argv[0], CYCLES_PER_FRAME, DEFAULT_REWIND_SECONDS, chip8::DEFAULT_PALETTE.foreground,
+                   chip8::DEFAULT_PALETTE.background);
         return 1;
     }
 
     auto context = std::make_unique<chip8::Chip8Context>();
-    if (!loadROM(context.get(), argv[1])) {
-        fmt::print("Couldn't load ROM {}\n", argv[1]);
+    std::vector<std::uint8_t> rom;
+    if (!loadROM(context.get(), options.romPath, rom)) {
+        fmt::print("Couldn't load ROM {}\n", options.romPath);
         return 1;
     }
 
@@ -91,11 +552,12 @@ int main(int argc, char* argv[])
         SDL_DestroyWindow);
 
     auto renderer = std::unique_ptr<SDL_Renderer, decltype(&SDL_DestroyRenderer)>(
-        SDL_CreateRenderer(window.get(), -1, 0),
+        SDL_CreateRenderer(window.get(), -1, options.vsync ? SDL_RENDERER_PRESENTVSYNC : 0),
         SDL_DestroyRenderer);
 
     auto texture = std::unique_ptr<SDL_Texture, decltype(&SDL_DestroyTexture)>(
-        SDL_CreateTexture(renderer.get(), SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STATIC,
+        SDL_CreateTexture(renderer.get(), SDL_PIXELFORMAT_RGBA8888,
+                          options.streaming ? SDL_TEXTUREACCESS_STREAMING : SDL_TEXTUREACCESS_STATIC,
                           chip8::FRAMEBUFFER_WIDTH, chip8::FRAMEBUFFER_HEIGHT),
         SDL_DestroyTexture);
 
@@ -104,20 +566,78 @@ int main(int argc, char* argv[])
       return 1;
     }
 
-    std::srand(std::time(0));
+    const auto seed = static_cast<std::uint32_t>(std::time(0));
+    context->seedRandom(seed);
+
+    std::unique_ptr<chip8::Movie> movie;
+    if (options.recordPath) {
+        movie = std::make_unique<chip8::Movie>();
+        chip8::beginMovie(*movie, rom, seed, options.cyclesPerFrame, *context);
+    }
 
     auto drawRect = computeDrawRect(WINDOW_WIDTH, WINDOW_HEIGHT);
 
-    for (int i = 0; i < 10000; i++) {
-        context->tick();
-        copyFramebuffer(context.get(), texture.get());
+    // Emulation runs on its own thread at the pace of the timers (or flat
+    // out); this one presents whatever frame is newest once per display
+    // refresh, which with vsync on is what SDL_RenderPresent waits for.
+    std::unique_ptr<chip8::Pacer> displayPacer;
+    if (options.vsync) {
+        displayPacer = std::make_unique<chip8::UnthrottledPacer>();
+    } else {
+        displayPacer = std::make_unique<chip8::RealTimePacer>(getRefreshRate(window.get()));
+    }
+
+    Emulation emulation;
+    std::thread emulationThread(runEmulation, context.get(), std::ref(emulation), std::cref(options),
+                                movie.get());
+
+    Statistics statistics;
+    TextureState textureState;
+    textureState.streaming = options.streaming;
+
+    std::uint16_t keys = 0;
+    std::uint16_t sentKeys = 0;
+    bool rewinding = false;
+
+    while (!emulation.finished.load(std::memory_order_acquire)) {
+        if (!handleEvents(keys, rewinding)) {
+            break;
+        }
+
+        emulation.rewinding.store(rewinding, std::memory_order_relaxed);
+
+        // If the queue is full the state is sent again next time round.
+        if (keys != sentKeys && emulation.keys.push(keys)) {
+            sentKeys = keys;
+        }
+
+        const auto now = Clock::now();
+
+        if (emulation.frames.update()) {
+            if (copyFramebuffer(emulation.frames.front(), texture.get(), textureState, options.palette)) {
+                statistics.uploadTime += Clock::now() - now;
+                statistics.uploads++;
+            }
+        }
 
         SDL_RenderClear(renderer.get());
         SDL_RenderCopy(renderer.get(), texture.get(), nullptr, &drawRect);
         SDL_RenderPresent(renderer.get());
+        statistics.presents++;
+
+        displayPacer->endFrame();
+        reportStatistics(emulation.frames.front(), statistics, now, options);
     }
 
-    SDL_Delay(1000);
+    emulation.stop.store(true, std::memory_order_relaxed);
+    emulationThread.join();
+
+    if (movie) {
+        std::ofstream file(options.recordPath, std::ios::binary);
+        if (!chip8::writeMovie(file, *movie)) {
+            fmt::print("Couldn't save the movie to {}\n", options.recordPath);
+        }
+    }
 
     SDL_Quit();
 
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "aot.h"
+#include "chip8.h"
+#include "movie.h"
+#include "state.h"
+
+namespace
+{
+    const char MAGIC[4] = { 'C', '8', 'M', 'V' };
+
+    // Longest run of one keypad state written as a single entry.
+    const std::uint64_t MAX_RUN = 0xFFFFFFFF;
+
+    // A day of frames. Longer recordings are taken to be corrupt rather
+    // than allocated for.
+    const std::uint64_t MAX_FRAMES = 24ull * 60 * 60 * chip8::TIMER_FREQUENCY;
+
+    // Reserved up front when reading, however many entries a file claims,
+    // so a corrupt count fails on the short read instead of allocating.
+    const std::size_t MAX_RESERVE = 1 << 16;
+
+    template<typename T>
+    void put(std::ostream& out, T value)
+    {
+        static_assert(std::is_unsigned<T>::value, "Only unsigned fields are stored");
+
+        char bytes[sizeof(T)];
+        for (std::size_t i = 0; i < sizeof(T); i++) {
+            bytes[i] = static_cast<char>(value >> (i * 8));
+        }
+
+        out.write(bytes, sizeof(T));
+    }
+
+    template<typename T>
+    bool get(std::istream& in, T& value)
+    {
+        static_assert(std::is_unsigned<T>::value, "Only unsigned fields are stored");
+
+        unsigned char bytes[sizeof(T)];
+        if (!in.read(reinterpret_cast<char*>(bytes), sizeof(T))) {
+            return false;
+        }
+
+        value = 0;
+        for (std::size_t i = 0; i < sizeof(T); i++) {
+            value |= static_cast<T>(bytes[i]) << (i * 8);
+        }
+
+        return true;
+    }
+
+    void put(std::ostream& out, std::uint8_t value)
+    {
+        out.put(static_cast<char>(value));
+    }
+
+    bool get(std::istream& in, std::uint8_t& value)
+    {
+        char byte;
+        if (!in.get(byte)) {
+            return false;
+        }
+
+        value = static_cast<std::uint8_t>(byte);
+        return true;
+    }
+}
+
+namespace chip8
+{
+    bool writeMovie(std::ostream& out, const Movie& movie)
+    {
+        out.write(MAGIC, sizeof(MAGIC));
+        put(out, MOVIE_FILE_VERSION);
+
+        put(out, movie.romHash);
+        put(out, movie.romSize);
+        put(out, movie.seed);
+        put(out, movie.cyclesPerFrame);
+        put(out, static_cast<std::uint8_t>(movie.stackPolicy));
+        put(out, movie.timerPeriod);
+        put(out, static_cast<std::uint8_t>(movie.skipIdleLoops));
+        put(out, movie.checkpointInterval);
+
+        // Keys change rarely next to the frame rate, so runs make a long
+        // session a few KB.
+        std::vector<std::pair<std::uint32_t, std::uint16_t>> runs;
+
+        for (auto keys : movie.keys) {
+            if (runs.empty() || runs.back().second != keys || runs.back().first == MAX_RUN) {
+                runs.emplace_back(0, keys);
+            }
+
+            runs.back().first++;
+        }
+
+        put(out, static_cast<std::uint64_t>(runs.size()));
+        for (const auto& run : runs) {
+            put(out, run.first);
+            put(out, run.second);
+        }
+
+        put(out, static_cast<std::uint64_t>(movie.checkpoints.size()));
+        for (auto hash : movie.checkpoints) {
+            put(out, hash);
+        }
+
+        return static_cast<bool>(out);
+    }
+
+    bool readMovie(std::istream& in, Movie& movie)
+    {
+        char magic[sizeof(MAGIC)];
+        if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+            return false;
+        }
+
+        std::uint16_t version;
+        if (!get(in, version) || version != MOVIE_FILE_VERSION) {
+            return false;
+        }
+
+        Movie loaded;
+        std::uint8_t stackPolicy;
+        std::uint8_t skipIdleLoops;
+
+        if (!get(in, loaded.romHash) || !get(in, loaded.romSize) || !get(in, loaded.seed) ||
+            !get(in, loaded.cyclesPerFrame) || !get(in, stackPolicy) || !get(in, loaded.timerPeriod) ||
+            !get(in, skipIdleLoops) || !get(in, loaded.checkpointInterval)) {
+            return false;
+        }
+
+        if (loaded.cyclesPerFrame == 0 || loaded.checkpointInterval == 0 ||
+            stackPolicy > static_cast<std::uint8_t>(StackPolicy::Abort) || skipIdleLoops > 1) {
+            return false;
+        }
+
+        loaded.stackPolicy = static_cast<StackPolicy>(stackPolicy);
+        loaded.skipIdleLoops = skipIdleLoops != 0;
+
+        std::uint64_t runs;
+        if (!get(in, runs)) {
+            return false;
+        }
+
+        for (std::uint64_t run = 0; run < runs; run++) {
+            std::uint32_t frames;
+            std::uint16_t keys;
+
+            if (!get(in, frames) || !get(in, keys) || frames == 0 || loaded.keys.size() + frames > MAX_FRAMES) {
+                return false;
+            }
+
+            loaded.keys.insert(loaded.keys.end(), frames, keys);
+        }
+
+        std::uint64_t checkpoints;
+        if (!get(in, checkpoints) || checkpoints != loaded.keys.size() / loaded.checkpointInterval) {
+            return false;
+        }
+
+        loaded.checkpoints.reserve(static_cast<std::size_t>(std::min<std::uint64_t>(checkpoints, MAX_RESERVE)));
+
+        for (std::uint64_t i = 0; i < checkpoints; i++) {
+            std::uint64_t hash;
+            if (!get(in, hash)) {
+                return false;
+            }
+
+            loaded.checkpoints.push_back(hash);
+        }
+
+        movie = std::move(loaded);
+        return true;
+    }
+
+    void beginMovie(Movie& movie, const std::vector<std::uint8_t>& rom, std::uint32_t seed,
+                    std::uint64_t cyclesPerFrame, const Chip8Context& context)
+    {
+        movie.romHash = hashROM(rom.data(), rom.size());
+        movie.romSize = rom.size();
+        movie.seed = seed;
+        movie.cyclesPerFrame = cyclesPerFrame;
+        movie.stackPolicy = context.getStackPolicy();
+        movie.timerPeriod = context.getTimerPeriod();
+        movie.skipIdleLoops = context.getIdleLoopSkipping();
+        movie.keys.clear();
+        movie.checkpoints.clear();
+    }
+
+    void recordFrame(Movie& movie, std::uint16_t keys, const Chip8Context& context)
+    {
+        movie.keys.push_back(keys);
+
+        if (movie.keys.size() % movie.checkpointInterval == 0) {
+            State state;
+            context.saveState(state);
+            movie.checkpoints.push_back(hashState(state));
+        }
+    }
+
+    void truncateMovie(Movie& movie, std::size_t frames)
+    {
+        if (frames < movie.keys.size()) {
+            movie.keys.resize(frames);
+            movie.checkpoints.resize(frames / movie.checkpointInterval);
+        }
+    }
+
+    bool isMovieROM(const Movie& movie, const std::vector<std::uint8_t>& rom)
+    {
+        return rom.size() == movie.romSize && hashROM(rom.data(), rom.size()) == movie.romHash;
+    }
+
+    ReplayResult replayMovie(const Movie& movie, Chip8Context& context)
+    {
+        context.seedRandom(movie.seed);
+        context.setStackPolicy(movie.stackPolicy);
+        context.setTimerPeriod(movie.timerPeriod);
+        context.setIdleLoopSkipping(movie.skipIdleLoops);
+
+        ReplayResult result;
+        State state;
+
+        for (auto keys : movie.keys) {
+            context.setKeys(keys);
+            context.runFrame(movie.cyclesPerFrame);
+            result.frames++;
+
+            if (result.frames % movie.checkpointInterval == 0) {
+                context.saveState(state);
+
+                if (hashState(state) != movie.checkpoints[result.checkpoints]) {
+                    result.diverged = true;
+                    break;
+                }
+
+                result.checkpoints++;
+            }
+        }
+
+        return result;
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "chip8.h"
+
+namespace chip8
+{
+    // A second's worth of frames between state hashes by default.
+    const std::uint32_t DEFAULT_CHECKPOINT_INTERVAL = TIMER_FREQUENCY;
+
+    // A recorded session: everything needed to play it back from power-on
+    // and get the same states again. Emulation only depends on the ROM, the
+    // RND seed, the settings here and the keypad each frame, so that's all
+    // that's kept, along with a hash of the state every so often to check a
+    // playback against.
+    struct Movie
+    {
+        std::uint64_t romHash = 0;
+        std::uint64_t romSize = 0;
+        std::uint32_t seed = 0;
+        std::uint64_t cyclesPerFrame = 0;
+        StackPolicy stackPolicy = StackPolicy::Trap;
+        std::uint64_t timerPeriod = 0;
+
+        // Skipping is exact but counted in getIdleCycles(), which the
+        // checkpoints hash, so it has to match too.
+        bool skipIdleLoops = true;
+
+        // Keypad state for each frame, as given to setKeys() before it.
+        std::vector<std::uint16_t> keys;
+
+        // hashState() after every checkpointInterval frames.
+        std::uint32_t checkpointInterval = DEFAULT_CHECKPOINT_INTERVAL;
+        std::vector<std::uint64_t> checkpoints;
+    };
+
+    // Movie files are the four bytes "C8MV", a 16-bit format version, the
+    // settings, the keypad states run-length encoded as a 32-bit frame count
+    // and the 16-bit state held for them, then the checkpoints. Everything is
+    // little endian. Checkpoints are hashes of states, so the version goes up
+    // with STATE_FILE_VERSION too.
+    const std::uint16_t MOVIE_FILE_VERSION = 3;
+
+    bool writeMovie(std::ostream& out, const Movie& movie);
+
+    // Returns false, leaving movie untouched, if the stream doesn't hold a
+    // complete, consistent movie of the current version.
+    bool readMovie(std::istream& in, Movie& movie);
+
+    // Starts a recording of a context that has just had rom loaded and been
+    // seeded with seed.
+    void beginMovie(Movie& movie, const std::vector<std::uint8_t>& rom, std::uint32_t seed,
+                    std::uint64_t cyclesPerFrame, const Chip8Context& context);
+
+    // Adds a frame that has just been run with keys held.
+    void recordFrame(Movie& movie, std::uint16_t keys, const Chip8Context& context);
+
+    // Forgets everything after the first frames frames, for when the
+    // recorded context has been rewound to that point.
+    void truncateMovie(Movie& movie, std::size_t frames);
+
+    // Whether rom is the one the movie was recorded with.
+    bool isMovieROM(const Movie& movie, const std::vector<std::uint8_t>& rom);
+
+    struct ReplayResult
+    {
+        // Frames run, up to and including the first one whose checkpoint
+        // didn't match.
+        std::uint64_t frames = 0;
+        std::uint64_t checkpoints = 0;
+        bool diverged = false;
+    };
+
+    // Plays a movie back as fast as the context goes, stopping at the first
+    // checkpoint that doesn't match. The context must have the movie's ROM
+    // loaded and nothing run yet; the seed and settings are applied here.
+    ReplayResult replayMovie(const Movie& movie, Chip8Context& context);
+}
+
+#endif
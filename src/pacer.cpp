@@ -0,0 +1,28 @@
+#include <chrono>
+#include <thread>
+
+#include "pacer.h"
+
+namespace chip8
+{
+    RealTimePacer::RealTimePacer(unsigned frequency)
+        : m_period(std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)) / frequency),
+          m_deadline(Clock::now() + m_period)
+    {
+    }
+
+    void RealTimePacer::endFrame()
+    {
+        auto now = Clock::now();
+
+        if (now < m_deadline) {
+            std::this_thread::sleep_until(m_deadline);
+            m_deadline += m_period;
+        } else {
+            // More than a frame behind (a slow host, or the window being
+            // dragged): start counting again from now instead of rushing
+            // through the backlog.
+            m_deadline = now + m_period;
+        }
+    }
+}
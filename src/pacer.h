@@ -0,0 +1,47 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <chrono>
+
+#include "chip8.h"
+
+namespace chip8
+{
+    // Decides how the front end lines frames up with wall clock time. The
+    // emulator itself only counts instructions, so swapping pacers changes
+    // how fast a session plays, never what happens in it.
+    class Pacer
+    {
+    public:
+        virtual ~Pacer() = default;
+
+        // Called once after each frame has been emulated and presented.
+        virtual void endFrame() = 0;
+    };
+
+    // Sleeps so that frames go out at a fixed rate.
+    class RealTimePacer : public Pacer
+    {
+    public:
+        explicit RealTimePacer(unsigned frequency = TIMER_FREQUENCY);
+
+        void endFrame() override;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        Clock::duration m_period;
+        Clock::time_point m_deadline;
+    };
+
+    // Runs frames back to back as fast as the host allows.
+    class UnthrottledPacer : public Pacer
+    {
+    public:
+        void endFrame() override
+        {
+        }
+    };
+}
+
+#endif
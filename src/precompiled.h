@@ -11,11 +11,8 @@
 #include <fstream>
 #include <memory>
 #include <optional>
-#include <stack>
 #include <vector>
 
-#include <SDL2/SDL.h>
-
 #include "format.h"
 
 #endif
@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "format.h"
+#include "chip8.h"
+#include "profile.h"
+
+namespace
+{
+    using Kind = chip8::InstructionKind;
+
+    struct KindInfo
+    {
+        const char* name;
+        const char* pattern;
+    };
+
+    // Must be kept in the same order as Kind.
+    const KindInfo KINDS[] = {
+        { "unknown",    "????" },
+        { "CLS",        "00E0" },
+        { "RET",        "00EE" },
+        { "JP",         "1nnn" },
+        { "CALL",       "2nnn" },
+        { "SE",         "3xnn" },
+        { "SNE",        "4xnn" },
+        { "LD",         "6xnn" },
+        { "ADD",        "7xnn" },
+        { "LD_VV",      "8xy0" },
+        { "OR",         "8xy1" },
+        { "AND",        "8xy2" },
+        { "XOR",        "8xy3" },
+        { "ADD_VV",     "8xy4" },
+        { "SUB",        "8xy5" },
+        { "SHR",        "8xy6" },
+        { "SUBN",       "8xy7" },
+        { "SHL",        "8xyE" },
+        { "LDI",        "Annn" },
+        { "RND",        "Cxnn" },
+        { "DRW",        "Dxyn" },
+        { "LD_V_DT",    "Fx07" },
+        { "LD_DT_V",    "Fx15" },
+        { "LD_ST_V",    "Fx18" },
+        { "ADD_I_V",    "Fx1E" },
+        { "SKP",        "Ex9E" },
+        { "SKNP",       "ExA1" },
+        { "LD_V_K",     "Fx0A" },
+        { "breakpoint", "????" },
+        { "idle_loop",  "????" },
+    };
+
+    static_assert(sizeof(KINDS) / sizeof(KINDS[0]) == static_cast<std::size_t>(Kind::Count),
+                  "Kind names don't match Kind");
+
+    const auto KIND_COUNT = static_cast<std::size_t>(Kind::Count);
+
+    // Every value getOpcode() returns, in the order they're listed.
+    const std::array<char, 17> OPCODES = {{
+        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F', '?',
+    }};
+
+    // The opcode nibble a kind belongs to, as a hex digit, or '?' for
+    // unknown instructions.
+    char getOpcode(Kind kind)
+    {
+        return KINDS[static_cast<std::size_t>(kind)].pattern[0];
+    }
+
+    // Addresses executed, busiest first.
+    std::vector<std::pair<std::uint64_t, std::uint16_t>> sortAddresses(const chip8::Profile& profile)
+    {
+        std::vector<std::pair<std::uint64_t, std::uint16_t>> addresses;
+
+        for (std::uint16_t address = 0; address < chip8::MEMORY_SIZE; address++) {
+            if (profile.addresses[address] != 0) {
+                addresses.emplace_back(profile.addresses[address], address);
+            }
+        }
+
+        std::sort(addresses.begin(), addresses.end(), [](const auto& a, const auto& b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        });
+
+        return addresses;
+    }
+
+    // What's in memory at each address executed. The guest can't write to
+    // memory, so it's what was run there.
+    chip8::Instruction decodeAt(const chip8::State& state, std::uint16_t address)
+    {
+        std::uint16_t raw = state.memory[address] << 8;
+        if (address + 1u < chip8::MEMORY_SIZE) {
+            raw |= state.memory[address + 1];
+        }
+
+        return chip8::decodeInstruction(raw);
+    }
+}
+
+namespace chip8
+{
+    const char* getKindName(InstructionKind kind)
+    {
+        return KINDS[static_cast<std::size_t>(kind)].name;
+    }
+
+    const char* getKindPattern(InstructionKind kind)
+    {
+        return KINDS[static_cast<std::size_t>(kind)].pattern;
+    }
+
+    void writeProfileJson(std::FILE* out, const Chip8Context& context)
+    {
+        const auto& profile = context.getProfile();
+        const auto total = std::accumulate(profile.kinds.begin(), profile.kinds.end(), std::uint64_t(0));
+
+        State state;
+        context.saveState(state);
+
+        fmt::print(out, "{{\n  \"profiling\": {},\n  \"instructions\": {},\n  \"idle\": {},\n",
+                   PROFILING ? "true" : "false", total, context.getIdleCycles());
+
+        // Opcodes in nibble order, each with its sub-ops.
+        fmt::print(out, "  \"opcodes\": [");
+        bool firstOpcode = true;
+
+        for (auto opcode : OPCODES) {
+            std::uint64_t count = 0;
+            for (std::size_t kind = 0; kind < KIND_COUNT; kind++) {
+                if (getOpcode(static_cast<Kind>(kind)) == opcode) {
+                    count += profile.kinds[kind];
+                }
+            }
+
+            if (count == 0) {
+                continue;
+            }
+
+            fmt::print(out, "{}\n    {{\"opcode\": \"{}\", \"count\": {}, \"sub_ops\": [",
+                       firstOpcode ? "" : ",", opcode, count);
+            firstOpcode = false;
+
+            bool firstKind = true;
+            for (std::size_t kind = 0; kind < KIND_COUNT; kind++) {
+                if (getOpcode(static_cast<Kind>(kind)) != opcode || profile.kinds[kind] == 0) {
+                    continue;
+                }
+
+                fmt::print(out, "{}{{\"name\": \"{}\", \"pattern\": \"{}\", \"count\": {}}}",
+                           firstKind ? "" : ", ", KINDS[kind].name, KINDS[kind].pattern, profile.kinds[kind]);
+                firstKind = false;
+            }
+
+            fmt::print(out, "]}}");
+        }
+
+        fmt::print(out, "\n  ],\n  \"addresses\": [");
+
+        const auto addresses = sortAddresses(profile);
+        for (std::size_t index = 0; index < addresses.size(); index++) {
+            const auto address = addresses[index].second;
+            const auto instruction = decodeAt(state, address);
+
+            fmt::print(out, "{}\n    {{\"pc\": {}, \"opcode\": \"{:04X}\", \"name\": \"{}\", \"count\": {}}}",
+                       index ? "," : "", address, instruction.raw, getKindName(instruction.kind),
+                       addresses[index].first);
+        }
+
+        std::uint64_t sprites = 0;
+        std::uint64_t rows = 0;
+        for (std::size_t height = 0; height < profile.spriteHeights.size(); height++) {
+            sprites += profile.spriteHeights[height];
+            rows += profile.spriteHeights[height] * height;
+        }
+
+        fmt::print(out, "\n  ],\n  \"drw\": {{\"sprites\": {}, \"rows\": {}, \"collisions\": {}, "
+                   "\"colliding_rows\": {}, \"wrapped\": {}, \"heights\": [",
+                   sprites, rows, profile.collisions, profile.collidingRows, profile.wrappedSprites);
+
+        for (std::size_t height = 0; height < profile.spriteHeights.size(); height++) {
+            fmt::print(out, "{}{}", height ? ", " : "", profile.spriteHeights[height]);
+        }
+
+        fmt::print(out, "]}}\n}}\n");
+    }
+
+    void writeProfileCollapsed(std::FILE* out, const Chip8Context& context)
+    {
+        State state;
+        context.saveState(state);
+
+        for (const auto& entry : sortAddresses(context.getProfile())) {
+            const auto instruction = decodeAt(state, entry.second);
+
+            fmt::print(out, "{:X};{};{:#05x} {}\n",
+                       static_cast<unsigned>(instruction.op), getKindName(instruction.kind), entry.second, entry.first);
+        }
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdio>
+
+#include "chip8.h"
+
+namespace chip8
+{
+    // Mnemonic used for an instruction kind in profiles, and the pattern of
+    // opcodes it covers, e.g. "XOR" and "8xy3".
+    const char* getKindName(InstructionKind kind);
+    const char* getKindPattern(InstructionKind kind);
+
+    // Writes context.getProfile() as one JSON object: totals, instructions
+    // by opcode with each one's sub-ops, every address executed with what's
+    // there (busiest first), and the DRW counters.
+    void writeProfileJson(std::FILE* out, const Chip8Context& context);
+
+    // Writes the address counts as collapsed stacks for flamegraph.pl and
+    // the like, a line per address executed, e.g. "8;XOR;0x2a4 1200".
+    void writeProfileCollapsed(std::FILE* out, const Chip8Context& context);
+}
+
+#endif
@@ -0,0 +1,258 @@
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "chip8.h"
+#include "rewind.h"
+
+namespace
+{
+    // Equal bytes inside a run of differences are kept as literals unless
+    // there are at least this many in a row, as ending the run and starting
+    // another costs at least two bytes of lengths.
+    const std::size_t MIN_ZERO_RUN = 4;
+
+    const std::uint8_t ZEROS[sizeof(chip8::State)] = { 0 };
+
+    void writeLength(std::vector<std::uint8_t>& out, std::size_t length)
+    {
+        while (length >= 0x80) {
+            out.push_back(static_cast<std::uint8_t>(length | 0x80));
+            length >>= 7;
+        }
+
+        out.push_back(static_cast<std::uint8_t>(length));
+    }
+
+    std::size_t readLength(const std::uint8_t*& in)
+    {
+        std::size_t length = 0;
+        unsigned shift = 0;
+
+        while (*in & 0x80) {
+            length |= static_cast<std::size_t>(*in++ & 0x7F) << shift;
+            shift += 7;
+        }
+
+        return length | static_cast<std::size_t>(*in++) << shift;
+    }
+
+    std::uint64_t load64(const std::uint8_t* bytes)
+    {
+        std::uint64_t value;
+        std::memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    // Appends current XOR reference as pairs of a count of zero bytes and a
+    // count of literal bytes, followed by the literals.
+    void encode(const std::uint8_t* current, const std::uint8_t* reference, std::size_t size,
+                std::vector<std::uint8_t>& out)
+    {
+        std::size_t i = 0;
+
+        while (i < size) {
+            const auto zeroStart = i;
+
+            // Most of a delta is unchanged memory, so skip a word at a time.
+            while (i + 8 <= size && load64(current + i) == load64(reference + i)) {
+                i += 8;
+            }
+
+            while (i < size && current[i] == reference[i]) {
+                i++;
+            }
+
+            const auto literalStart = i;
+
+            while (i < size) {
+                if (current[i] != reference[i]) {
+                    i++;
+                    continue;
+                }
+
+                std::size_t run = 0;
+                while (i + run < size && run < MIN_ZERO_RUN && current[i + run] == reference[i + run]) {
+                    run++;
+                }
+
+                if (run == MIN_ZERO_RUN || i + run == size) {
+                    break;
+                }
+
+                i += run;
+            }
+
+            writeLength(out, literalStart - zeroStart);
+            writeLength(out, i - literalStart);
+
+            for (auto at = literalStart; at < i; at++) {
+                out.push_back(current[at] ^ reference[at]);
+            }
+        }
+    }
+
+    // XORs an encoding made by encode() into state, which holds the
+    // reference it was made against.
+    void decode(const std::uint8_t* in, const std::uint8_t* end, std::uint8_t* state)
+    {
+        while (in < end) {
+            state += readLength(in);
+
+            for (auto count = readLength(in); count > 0; count--) {
+                *state++ ^= *in++;
+            }
+        }
+    }
+}
+
+namespace chip8
+{
+    RewindBuffer::RewindBuffer(std::size_t capacity, std::size_t keyframeInterval)
+        : m_keyframeInterval(keyframeInterval)
+    {
+        assert(capacity > 0 && keyframeInterval > 0);
+
+        // Enough whole groups to hold capacity frames even just after the
+        // oldest has been dropped to make way for a new one.
+        m_groups.resize((capacity + keyframeInterval - 1) / keyframeInterval + 1);
+
+        std::memset(&m_keyframe, 0, sizeof(m_keyframe));
+        std::memset(&m_scratch, 0, sizeof(m_scratch));
+    }
+
+    void RewindBuffer::push(const Chip8Context& context)
+    {
+        context.saveState(m_scratch);
+        push(m_scratch);
+    }
+
+    void RewindBuffer::push(const State& state)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const auto bytes = reinterpret_cast<const std::uint8_t*>(&state);
+
+        Group* group;
+        std::size_t before;
+
+        if (m_groupCount == 0 || getGroup(0).ends.size() >= m_keyframeInterval) {
+            if (m_groupCount == m_groups.size()) {
+                m_frames -= getGroup(m_groupCount - 1).ends.size();
+                m_groupCount--;
+            }
+
+            if (m_groupCount > 0) {
+                m_newest = (m_newest + 1) % m_groups.size();
+            }
+
+            m_groupCount++;
+
+            group = &m_groups[m_newest];
+            group->data.clear();
+            group->ends.clear();
+            group->id = m_nextGroupId++;
+
+            before = 0;
+            encode(bytes, ZEROS, sizeof(State), group->data);
+
+            std::memcpy(&m_keyframe, &state, sizeof(State));
+            m_keyframeId = group->id;
+            m_stats.keyframes++;
+        } else {
+            group = &getGroup(0);
+            const auto& keyframe = loadKeyframe(*group);
+
+            before = group->data.size();
+            encode(bytes, reinterpret_cast<const std::uint8_t*>(&keyframe), sizeof(State), group->data);
+        }
+
+        group->ends.push_back(static_cast<std::uint32_t>(group->data.size()));
+        m_frames++;
+
+        m_stats.frames++;
+        m_stats.encodedBytes += group->data.size() - before;
+        m_stats.encodeTime += std::chrono::steady_clock::now() - start;
+    }
+
+    bool RewindBuffer::peek(std::size_t age, State& state)
+    {
+        if (age >= m_frames) {
+            return false;
+        }
+
+        for (std::size_t index = 0; index < m_groupCount; index++) {
+            const auto& group = getGroup(index);
+            const auto count = group.ends.size();
+
+            if (age < count) {
+                decodeFrame(group, count - 1 - age, state);
+                return true;
+            }
+
+            age -= count;
+        }
+
+        return false;
+    }
+
+    bool RewindBuffer::stepBack(State& state)
+    {
+        if (m_frames < 2) {
+            return false;
+        }
+
+        auto& group = getGroup(0);
+        group.ends.pop_back();
+        m_frames--;
+
+        if (group.ends.empty()) {
+            m_newest = (m_newest + m_groups.size() - 1) % m_groups.size();
+            m_groupCount--;
+        } else {
+            group.data.resize(group.ends.back());
+        }
+
+        return peek(0, state);
+    }
+
+    void RewindBuffer::clear()
+    {
+        m_groupCount = 0;
+        m_frames = 0;
+        m_keyframeId = 0;
+    }
+
+    std::size_t RewindBuffer::getMemoryUsage() const
+    {
+        std::size_t bytes = sizeof(*this) + m_groups.capacity() * sizeof(Group);
+
+        for (const auto& group : m_groups) {
+            bytes += group.data.capacity() + group.ends.capacity() * sizeof(std::uint32_t);
+        }
+
+        return bytes;
+    }
+
+    const State& RewindBuffer::loadKeyframe(const Group& group)
+    {
+        if (m_keyframeId != group.id) {
+            std::memset(&m_keyframe, 0, sizeof(State));
+            decode(group.data.data(), group.data.data() + group.ends[0], reinterpret_cast<std::uint8_t*>(&m_keyframe));
+            m_keyframeId = group.id;
+        }
+
+        return m_keyframe;
+    }
+
+    void RewindBuffer::decodeFrame(const Group& group, std::size_t index, State& state)
+    {
+        state = loadKeyframe(group);
+
+        if (index > 0) {
+            decode(group.data.data() + group.ends[index - 1], group.data.data() + group.ends[index],
+                   reinterpret_cast<std::uint8_t*>(&state));
+        }
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "chip8.h"
+
+namespace chip8
+{
+    // A second's worth of frames between keyframes by default.
+    const std::size_t DEFAULT_KEYFRAME_INTERVAL = TIMER_FREQUENCY;
+
+    struct RewindStats
+    {
+        std::uint64_t frames = 0;
+        std::uint64_t keyframes = 0;
+
+        // Size of every frame pushed once encoded, and the time spent
+        // encoding them.
+        std::uint64_t encodedBytes = 0;
+        std::chrono::steady_clock::duration encodeTime = std::chrono::steady_clock::duration::zero();
+    };
+
+    // History of a context's state a frame at a time, for stepping back
+    // through it. Frames are stored in groups, each a keyframe followed by
+    // the frames after it as deltas against that keyframe: the bytes of the
+    // State XORed with the keyframe's, run-length encoded. Keyframes are the
+    // same encoding against zero. Going to any frame decodes at most a
+    // keyframe (the last one is cached) and one delta, so scrubbing costs
+    // about the same in either direction.
+    //
+    // Whole groups are dropped when the buffer is full, so it holds between
+    // capacity and capacity + keyframeInterval - 1 frames once it has seen
+    // that many. Each group's storage is kept for reuse, so a full buffer
+    // doesn't allocate.
+    class RewindBuffer
+    {
+    public:
+        explicit RewindBuffer(std::size_t capacity, std::size_t keyframeInterval = DEFAULT_KEYFRAME_INTERVAL);
+
+        // Records the state after a frame.
+        void push(const Chip8Context& context);
+        void push(const State& state);
+
+        // Frames held, the newest included.
+        std::size_t size() const
+        {
+            return m_frames;
+        }
+
+        bool empty() const
+        {
+            return m_frames == 0;
+        }
+
+        // Copies the frame age frames older than the newest into state, or
+        // returns false if there isn't one that old.
+        bool peek(std::size_t age, State& state);
+
+        // Throws away the newest frame and copies the one before it into
+        // state, which becomes the newest. Returns false, dropping nothing,
+        // if there's no frame before it.
+        bool stepBack(State& state);
+
+        void clear();
+
+        // Bytes allocated for encoded frames and the keyframe cache.
+        std::size_t getMemoryUsage() const;
+
+        const RewindStats& getStats() const
+        {
+            return m_stats;
+        }
+
+    private:
+        struct Group
+        {
+            // Encoded frames back to back, the keyframe first, and where each
+            // one ends.
+            std::vector<std::uint8_t> data;
+            std::vector<std::uint32_t> ends;
+
+            // Identifies the group to the keyframe cache.
+            std::uint64_t id = 0;
+        };
+
+        // A ring, m_groupCount of them in use ending at m_newest.
+        std::vector<Group> m_groups;
+        std::size_t m_newest = 0;
+        std::size_t m_groupCount = 0;
+        std::size_t m_frames = 0;
+        std::size_t m_keyframeInterval;
+        std::uint64_t m_nextGroupId = 1;
+
+        // The decoded keyframe of the group with id m_keyframeId, 0 if none.
+        State m_keyframe;
+        std::uint64_t m_keyframeId = 0;
+
+        // What push(const Chip8Context&) saves into. Never written anywhere
+        // but its fields, so the padding stays zero and costs nothing in
+        // the deltas.
+        State m_scratch;
+
+        RewindStats m_stats;
+
+        Group& getGroup(std::size_t age)
+        {
+            return m_groups[(m_newest + m_groups.size() - age) % m_groups.size()];
+        }
+
+        const State& loadKeyframe(const Group& group);
+        void decodeFrame(const Group& group, std::size_t index, State& state);
+    };
+}
+
+#endif
@@ -0,0 +1,198 @@
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <type_traits>
+
+#include "chip8.h"
+#include "state.h"
+
+namespace
+{
+    const char MAGIC[4] = { 'C', '8', 'S', 'T' };
+
+    const std::size_t HEADER_SIZE = sizeof(MAGIC) + sizeof(std::uint16_t);
+
+    // Packs values little endian into a buffer. The buffer is exactly a
+    // file's worth, so it lives on the stack and a save never allocates.
+    class Writer
+    {
+    public:
+        explicit Writer(std::uint8_t* out)
+            : m_out(out)
+        {
+        }
+
+        template<typename T>
+        void operator()(const T& value)
+        {
+            static_assert(std::is_unsigned<T>::value, "Only unsigned fields are stored");
+
+            for (std::size_t i = 0; i < sizeof(T); i++) {
+                *m_out++ = static_cast<std::uint8_t>(value >> (i * 8));
+            }
+        }
+
+        void operator()(std::uint8_t value)
+        {
+            *m_out++ = value;
+        }
+
+        template<typename T, std::size_t N>
+        void operator()(const std::array<T, N>& values)
+        {
+            for (const auto& value : values) {
+                (*this)(value);
+            }
+        }
+
+        std::uint8_t* position() const
+        {
+            return m_out;
+        }
+
+    private:
+        std::uint8_t* m_out;
+    };
+
+    class Reader
+    {
+    public:
+        explicit Reader(const std::uint8_t* in)
+            : m_in(in)
+        {
+        }
+
+        template<typename T>
+        void operator()(T& value)
+        {
+            static_assert(std::is_unsigned<T>::value, "Only unsigned fields are stored");
+
+            value = 0;
+            for (std::size_t i = 0; i < sizeof(T); i++) {
+                value |= static_cast<T>(*m_in++) << (i * 8);
+            }
+        }
+
+        void operator()(std::uint8_t& value)
+        {
+            value = *m_in++;
+        }
+
+        template<typename T, std::size_t N>
+        void operator()(std::array<T, N>& values)
+        {
+            for (auto& value : values) {
+                (*this)(value);
+            }
+        }
+
+        const std::uint8_t* position() const
+        {
+            return m_in;
+        }
+
+    private:
+        const std::uint8_t* m_in;
+    };
+
+    // The one place the field order is spelt out, shared by both directions.
+    template<typename Archive, typename StateType>
+    void visitFields(Archive& archive, StateType& state)
+    {
+        archive(state.V);
+        archive(state.I);
+        archive(state.PC);
+        archive(state.DT);
+        archive(state.ST);
+        archive(state.SP);
+        archive(state.keys);
+        archive(state.stack);
+        archive(state.random);
+        archive(state.cycles);
+        archive(state.idleCycles);
+        archive(state.timerCountdown);
+        archive(state.resumeFromBreakpoint);
+        archive(state.framebuffer);
+        archive(state.memory);
+    }
+
+    // Fills a file's worth of bytes.
+    void pack(const chip8::State& state, std::uint8_t* out)
+    {
+        std::memcpy(out, MAGIC, sizeof(MAGIC));
+
+        Writer writer(out + sizeof(MAGIC));
+        writer(chip8::STATE_FILE_VERSION);
+        visitFields(writer, state);
+        assert(writer.position() == out + chip8::STATE_FILE_SIZE);
+    }
+}
+
+namespace chip8
+{
+    const std::size_t STATE_FILE_SIZE =
+        HEADER_SIZE +
+        NUM_GPRS + 2 + 2 + 1 + 1 + 1 + 2 +
+        STACK_SIZE * 2 +
+        8 * 4 + 1 +
+        FRAMEBUFFER_HEIGHT * sizeof(FramebufferRow) +
+        MEMORY_SIZE;
+
+    bool writeState(std::ostream& out, const State& state)
+    {
+        std::array<std::uint8_t, STATE_FILE_SIZE> buffer;
+        pack(state, buffer.data());
+
+        out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+        return static_cast<bool>(out);
+    }
+
+    bool readState(std::istream& in, State& state)
+    {
+        std::array<std::uint8_t, STATE_FILE_SIZE> buffer;
+
+        in.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+        if (static_cast<std::size_t>(in.gcount()) != buffer.size() ||
+            std::memcmp(buffer.data(), MAGIC, sizeof(MAGIC)) != 0) {
+            return false;
+        }
+
+        Reader reader(buffer.data() + sizeof(MAGIC));
+
+        std::uint16_t version;
+        reader(version);
+        if (version != STATE_FILE_VERSION) {
+            return false;
+        }
+
+        State loaded;
+        visitFields(reader, loaded);
+        assert(reader.position() == buffer.data() + buffer.size());
+
+        if (loaded.SP > STACK_SIZE || loaded.resumeFromBreakpoint > 1) {
+            return false;
+        }
+
+        state = loaded;
+        return true;
+    }
+
+    std::uint64_t hashState(const State& state)
+    {
+        std::array<std::uint8_t, STATE_FILE_SIZE> buffer;
+        pack(state, buffer.data());
+
+        std::uint64_t hash = 0xCBF29CE484222325ull;
+
+        for (auto byte : buffer) {
+            hash ^= byte;
+            hash *= 0x100000001B3ull;
+        }
+
+        return hash;
+    }
+}
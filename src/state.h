@@ -0,0 +1,37 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+#include "chip8.h"
+
+namespace chip8
+{
+    // Saved states on disk are the four bytes "C8ST", a 16-bit format
+    // version, then every field of State in declaration order, each at its
+    // own width and little endian whatever the host. Nothing depends on the
+    // in-memory layout, so a file reads back the same on any build.
+    //
+    // The version goes up whenever the fields change. readState() only
+    // accepts the current one; older versions get a converter here when
+    // there's a reason to keep them.
+    const std::uint16_t STATE_FILE_VERSION = 2;
+
+    // Size of a current version file.
+    extern const std::size_t STATE_FILE_SIZE;
+
+    bool writeState(std::ostream& out, const State& state);
+
+    // Returns false, leaving state untouched, if the stream doesn't hold a
+    // complete, sane state of the current version.
+    bool readState(std::istream& in, State& state);
+
+    // 64-bit FNV-1a of the state as it would be written to a file, so it
+    // depends on nothing but the fields.
+    std::uint64_t hashState(const State& state);
+}
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace chip8
+{
+    // Size of the chunk that threads contend over, used to keep the producer
+    // and consumer sides of the structures below off each other's lines.
+    const std::size_t CACHE_LINE_SIZE = 64;
+
+    // Hands the latest of a stream of values from one producer thread to one
+    // consumer thread. Neither side ever waits: the producer always has a
+    // slot to write to and the consumer always has the last complete value,
+    // skipping any that were overwritten before it looked.
+    template<typename T>
+    class TripleBuffer
+    {
+    public:
+        // Producer: the slot to fill in next. It holds an older value, so
+        // every field has to be written before publish().
+        T& back()
+        {
+            return m_slots[m_back];
+        }
+
+        // Producer: hands back() over to the consumer and moves on to a
+        // free slot.
+        void publish()
+        {
+            m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) & INDEX;
+        }
+
+        // Consumer: takes the most recently published value if it hasn't
+        // seen it yet. Returns whether front() changed.
+        bool update()
+        {
+            if (!(m_middle.load(std::memory_order_relaxed) & FRESH)) {
+                return false;
+            }
+
+            m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX;
+            return true;
+        }
+
+        // Consumer: the value picked up by the last update().
+        const T& front() const
+        {
+            return m_slots[m_front];
+        }
+
+    private:
+        static const std::uint8_t INDEX = 0x3;
+        static const std::uint8_t FRESH = 0x4;
+
+        std::array<T, 3> m_slots;
+
+        // Slot index owned by nobody, with FRESH set when it was published
+        // after the consumer last looked.
+        alignas(CACHE_LINE_SIZE) std::atomic<std::uint8_t> m_middle{ 1 };
+        alignas(CACHE_LINE_SIZE) std::uint8_t m_back = 0;
+        alignas(CACHE_LINE_SIZE) std::uint8_t m_front = 2;
+    };
+
+    // Bounded single producer, single consumer FIFO. Capacity must be a
+    // power of two.
+    template<typename T, std::size_t Capacity>
+    class SpscQueue
+    {
+        static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    public:
+        // Producer: returns false without queueing anything if it's full.
+        bool push(const T& value)
+        {
+            const auto tail = m_tail.load(std::memory_order_relaxed);
+            if (tail - m_head.load(std::memory_order_acquire) == Capacity) {
+                return false;
+            }
+
+            m_items[tail & (Capacity - 1)] = value;
+            m_tail.store(tail + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        // Consumer: returns false if there's nothing queued.
+        bool pop(T& value)
+        {
+            const auto head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            value = m_items[head & (Capacity - 1)];
+            m_head.store(head + 1, std::memory_order_release);
+
+            return true;
+        }
+
+    private:
+        std::array<T, Capacity> m_items;
+
+        alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> m_head{ 0 };
+        alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> m_tail{ 0 };
+    };
+}
+
+#endif
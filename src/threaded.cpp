@@ -0,0 +1,282 @@
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+
+#include "chip8.h"
+
+// Labels as values are a GNU extension; build with -DCHIP8_COMPUTED_GOTO=0 to
+// force the portable switch dispatch on compilers that do support them.
+#ifndef CHIP8_COMPUTED_GOTO
+#if defined(__GNUC__)
+#define CHIP8_COMPUTED_GOTO 1
+#else
+#define CHIP8_COMPUTED_GOTO 0
+#endif
+#endif
+
+namespace chip8
+{
+    std::uint64_t Chip8Context::executeThreaded(std::uint64_t count)
+    {
+        auto& V = m_registers.V;
+        const auto& decoded = *m_decoded;
+        std::uint16_t pc = m_registers.PC;
+        std::uint64_t remaining = count;
+        const Instruction* instruction;
+
+#if CHIP8_COMPUTED_GOTO
+        // Must be kept in the same order as Kind.
+        static void* const labels[] = {
+            &&op_Unknown,
+            &&op_CLS,
+            &&op_RET,
+            &&op_JP,
+            &&op_CALL,
+            &&op_SE,
+            &&op_SNE,
+            &&op_LD,
+            &&op_ADD,
+            &&op_LD_VV,
+            &&op_OR,
+            &&op_AND,
+            &&op_XOR,
+            &&op_ADD_VV,
+            &&op_SUB,
+            &&op_SHR,
+            &&op_SUBN,
+            &&op_SHL,
+            &&op_LDI,
+            &&op_RND,
+            &&op_DRW,
+            &&op_LD_V_DT,
+            &&op_LD_DT_V,
+            &&op_LD_ST_V,
+            &&op_ADD_I_V,
+            &&op_SKP,
+            &&op_SKNP,
+            &&op_LD_V_K,
+            &&op_Breakpoint,
+            &&op_IdleLoop,
+        };
+
+        static_assert(sizeof(labels) / sizeof(labels[0]) == static_cast<std::size_t>(Kind::Count),
+                      "Dispatch table doesn't match Kind");
+
+#define OP(name) op_##name:
+#define DISPATCH()                                                  \
+        do {                                                        \
+            if (remaining == 0) {                                   \
+                goto done;                                          \
+            }                                                       \
+            remaining--;                                            \
+            instruction = &decoded[pc & (MEMORY_SIZE - 1)];         \
+            countInstruction(pc, instruction->kind);                \
+            goto *labels[static_cast<std::uint8_t>(instruction->kind)]; \
+        } while (0)
+
+        DISPATCH();
+#else
+#define OP(name) case Kind::name:
+#define DISPATCH() goto dispatch
+
+    dispatch:
+        if (remaining == 0) {
+            goto done;
+        }
+
+        remaining--;
+
+        instruction = &decoded[pc & (MEMORY_SIZE - 1)];
+        countInstruction(pc, instruction->kind);
+
+        switch (instruction->kind) {
+        case Kind::Count:
+#endif
+
+        OP(Unknown)
+            m_registers.PC = pc;
+            reportUnknownInstruction(instruction->raw);
+            pc += INSTRUCTION_SIZE;
+            goto done;
+
+        OP(Breakpoint)
+            m_stopReason = StopReason::Breakpoint;
+            remaining++;
+            uncountInstruction(pc, instruction->kind);
+            goto done;
+
+        OP(IdleLoop)
+            m_stopReason = StopReason::IdleLoop;
+            remaining++;
+            uncountInstruction(pc, instruction->kind);
+            goto done;
+
+        OP(CLS)
+            clearScreen();
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(RET)
+            if (!popReturnAddress(pc, pc)) {
+                remaining++;
+                uncountInstruction(pc, instruction->kind);
+                goto done;
+            }
+            DISPATCH();
+
+        OP(JP)
+            pc = instruction->nnn;
+            DISPATCH();
+
+        OP(CALL)
+            if (!pushReturnAddress(pc, pc + INSTRUCTION_SIZE)) {
+                remaining++;
+                uncountInstruction(pc, instruction->kind);
+                goto done;
+            }
+            pc = instruction->nnn;
+            DISPATCH();
+
+        OP(SE)
+            pc += (V[instruction->x] == instruction->nn) ? INSTRUCTION_SIZE * 2 : INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(SNE)
+            pc += (V[instruction->x] != instruction->nn) ? INSTRUCTION_SIZE * 2 : INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(LD)
+            V[instruction->x] = instruction->nn;
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(ADD)
+            V[instruction->x] += instruction->nn;
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(LD_VV)
+            V[instruction->x] = V[instruction->y];
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(OR)
+            V[instruction->x] |= V[instruction->y];
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(AND)
+            V[instruction->x] &= V[instruction->y];
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(XOR)
+            V[instruction->x] ^= V[instruction->y];
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(ADD_VV)
+        {
+            std::uint16_t temp = V[instruction->x] + V[instruction->y];
+            V[0xF] = (temp & 0xFF00) ? 1 : 0;
+            V[instruction->x] = temp & 0x00FF;
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+        }
+
+        OP(SUB)
+            V[0xF] = (V[instruction->x] > V[instruction->y]) ? 1 : 0;
+            V[instruction->x] -= V[instruction->y];
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(SHR)
+            V[0xF] = V[instruction->x] & 1;
+            V[instruction->x] >>= 1;
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(SUBN)
+            V[0xF] = (V[instruction->y] > V[instruction->x]) ? 1 : 0;
+            V[instruction->x] = V[instruction->y] - V[instruction->x];
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(SHL)
+            V[0xF] = V[instruction->x] & 0x80;
+            V[instruction->x] <<= 1;
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(LDI)
+            m_registers.I = instruction->nnn;
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(RND)
+            V[instruction->x] = m_random.next() & instruction->nn;
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(DRW)
+            drawSprite(V[instruction->x], V[instruction->y], instruction->n);
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(LD_V_DT)
+            V[instruction->x] = m_registers.DT;
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(LD_DT_V)
+            m_registers.DT = V[instruction->x];
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(LD_ST_V)
+            m_registers.ST = V[instruction->x];
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(ADD_I_V)
+            m_registers.I += V[instruction->x];
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(SKP)
+            pc += isKeyPressed(V[instruction->x]) ? INSTRUCTION_SIZE * 2 : INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(SKNP)
+            pc += !isKeyPressed(V[instruction->x]) ? INSTRUCTION_SIZE * 2 : INSTRUCTION_SIZE;
+            DISPATCH();
+
+        OP(LD_V_K)
+            if (m_keys == 0) {
+                m_stopReason = StopReason::WaitForKey;
+                remaining++;
+                uncountInstruction(pc, instruction->kind);
+                goto done;
+            }
+
+            V[instruction->x] = 0;
+            while (!isKeyPressed(V[instruction->x])) {
+                V[instruction->x]++;
+            }
+
+            pc += INSTRUCTION_SIZE;
+            DISPATCH();
+
+#if !CHIP8_COMPUTED_GOTO
+        }
+#endif
+
+#undef OP
+#undef DISPATCH
+
+    done:
+        m_registers.PC = pc;
+        return count - remaining;
+    }
+}
@@ -0,0 +1,185 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "chip8.h"
+#include "cli.h"
+#include "format.h"
+#include "state.h"
+#include "testing.h"
+
+// Runs every core side by side over the fixed ROMs, a few hundred generated
+// ones and any given on the command line, under a spread of settings, and
+// checks each one's state against the table core's after every frame. make
+// test links in AOT translations of the fixed and generated ROMs, and of the
+// ones in roms/, so the Aot core runs them for real rather than falling back
+// to the threaded core. It also builds this against the switch fallback of
+// the threaded core, as test_cores_switch.
+
+namespace
+{
+    const std::uint64_t FRAMES = 120;
+    const std::uint64_t GIVEN_ROM_FRAMES = 600;
+
+    // The first is the reference.
+    const chip8::Core CORES[] = {
+        chip8::Core::Table,
+        chip8::Core::Threaded,
+        chip8::Core::Jit,
+        chip8::Core::Aot,
+    };
+
+    const std::size_t NUM_CORES = sizeof(CORES) / sizeof(CORES[0]);
+
+    struct Settings
+    {
+        chip8::StackPolicy stackPolicy;
+        std::uint64_t cyclesPerFrame;
+        std::uint64_t timerPeriod;
+        bool skipIdleLoops;
+    };
+
+    std::string describe(const Settings& settings)
+    {
+        return fmt::format("{}, {} cycles/frame, timer period {}, idle skipping {}",
+                           settings.stackPolicy == chip8::StackPolicy::Wrap ? "wrap" : "trap",
+                           settings.cyclesPerFrame, settings.timerPeriod, settings.skipIdleLoops ? "on" : "off");
+    }
+
+    // Every combination the ROM can take.
+    std::vector<Settings> getSettings(const tests::TestROM& rom)
+    {
+        std::vector<Settings> settings;
+
+        for (auto policy : { chip8::StackPolicy::Trap, chip8::StackPolicy::Wrap }) {
+            if (policy == chip8::StackPolicy::Wrap && !rom.wrapSafe) {
+                continue;
+            }
+
+            for (std::uint64_t cyclesPerFrame : { 7, 25 }) {
+                for (std::uint64_t timerPeriod : { 0, 13 }) {
+                    for (bool skipIdleLoops : { true, false }) {
+                        settings.push_back({ policy, cyclesPerFrame, timerPeriod, skipIdleLoops });
+                    }
+                }
+            }
+        }
+
+        return settings;
+    }
+
+    struct Totals
+    {
+        std::uint64_t runs = 0;
+        std::uint64_t frames = 0;
+        std::uint64_t failures = 0;
+        std::uint64_t translated = 0;
+    };
+
+    // Runs rom on every core for frames frames, comparing each against the
+    // reference after every one. Stops at the first difference, or straight
+    // away if the ROM has to have a translation and none is linked in.
+    bool check(const tests::TestROM& rom, const Settings& settings, std::uint32_t seed, std::uint64_t frames,
+               bool translated, Totals& totals)
+    {
+        std::array<std::unique_ptr<chip8::Chip8Context>, NUM_CORES> contexts;
+
+        for (std::size_t core = 0; core < NUM_CORES; core++) {
+            auto& context = contexts[core];
+            context = std::make_unique<chip8::Chip8Context>();
+            context->loadROM(rom.data);
+            context->setCore(CORES[core]);
+            context->setStackPolicy(settings.stackPolicy);
+            context->setTimerPeriod(settings.timerPeriod);
+            context->setIdleLoopSkipping(settings.skipIdleLoops);
+            context->seedRandom(seed);
+        }
+
+        totals.runs++;
+
+        if (contexts[NUM_CORES - 1]->getAotProgram() != nullptr) {
+            totals.translated++;
+        } else if (translated) {
+            fmt::print("FAIL {}: no AOT translation linked in\n", rom.name);
+            totals.failures++;
+            return false;
+        }
+
+        chip8::State expected;
+        chip8::State actual;
+        std::array<chip8::StopReason, NUM_CORES> reasons;
+
+        for (std::uint64_t frame = 0; frame < frames; frame++) {
+            const auto keys = tests::getKeys(seed, frame);
+
+            for (std::size_t core = 0; core < NUM_CORES; core++) {
+                contexts[core]->setKeys(keys);
+                reasons[core] = contexts[core]->runFrame(settings.cyclesPerFrame);
+            }
+
+            contexts[0]->saveState(expected);
+            totals.frames++;
+
+            for (std::size_t core = 1; core < NUM_CORES; core++) {
+                contexts[core]->saveState(actual);
+
+                if (reasons[core] == reasons[0] && chip8::hashState(actual) == chip8::hashState(expected)) {
+                    continue;
+                }
+
+                const auto difference = reasons[core] != reasons[0]
+                    ? fmt::format("{} instead of {}", chip8::getStopReasonName(reasons[core]),
+                                  chip8::getStopReasonName(reasons[0]))
+                    : tests::diffStates(expected, actual);
+
+                fmt::print("FAIL {} ({}) frame {}: {} core differs from table: {}\n",
+                           rom.name, describe(settings), frame, chip8::getCoreName(CORES[core]), difference);
+                totals.failures++;
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Totals totals;
+
+    for (const auto& rom : tests::getFixedROMs()) {
+        for (const auto& settings : getSettings(rom)) {
+            check(rom, settings, 1, FRAMES, true, totals);
+        }
+    }
+
+    // A different setting for each, which covers every one many times over.
+    for (std::uint32_t seed = 0; seed < tests::GENERATED_ROMS; seed++) {
+        const auto rom = tests::generateROM(seed, tests::GENERATED_LENGTH);
+        const auto settings = getSettings(rom);
+
+        check(rom, settings[seed % settings.size()], seed, FRAMES, true, totals);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        tests::TestROM rom = { argv[i], {}, false };
+
+        if (!chip8::readFile(argv[i], rom.data)) {
+            fmt::print("FAIL couldn't load ROM {}\n", argv[i]);
+            totals.failures++;
+            continue;
+        }
+
+        for (const auto& settings : getSettings(rom)) {
+            check(rom, settings, 1, GIVEN_ROM_FRAMES, false, totals);
+        }
+    }
+
+    fmt::print("{}: {} runs, {} frames compared on every core ({} runs with an AOT translation), {} failed\n",
+               argv[0], totals.runs, totals.frames, totals.translated, totals.failures);
+
+    return totals.failures == 0 ? 0 : 1;
+}
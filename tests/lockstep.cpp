@@ -0,0 +1,256 @@
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "chip8.h"
+#include "cli.h"
+#include "format.h"
+#include "lockstep.h"
+#include "state.h"
+#include "testing.h"
+
+// Runs each lane of a lockstep engine next to a scalar Chip8Context on the
+// table core, started from the same seed and fed the same keys, and checks
+// every lane's state against its context's after every step or frame. Lanes
+// are given their own seeds and keys so they split up, which is what the
+// grouping and select masks are there for; a run where every lane is fed the
+// same checks that they then never split up.
+
+namespace
+{
+    const std::uint64_t FRAMES = 60;
+    const std::uint64_t GIVEN_ROM_FRAMES = 300;
+    const std::uint32_t GENERATED_ROMS = 200;
+    const std::size_t GENERATED_LENGTH = 48;
+    const std::uint64_t CYCLES_PER_FRAME = 10;
+
+    struct Totals
+    {
+        std::uint64_t runs = 0;
+        std::uint64_t checks = 0;
+        std::uint64_t failures = 0;
+
+        // Checks at which lanes were at more than one PC, and at which some
+        // had stopped while others ran to the end.
+        std::uint64_t divergent = 0;
+        std::uint64_t masked = 0;
+    };
+
+    template<std::size_t Lanes>
+    class Harness
+    {
+    public:
+        Harness(const tests::TestROM& rom, chip8::StackPolicy policy, bool shared)
+            : m_rom(rom)
+            , m_policy(policy)
+            , m_shared(shared)
+            , m_lockstep(std::make_unique<chip8::Lockstep<Lanes>>())
+        {
+            m_lockstep->loadROM(rom.data);
+            m_lockstep->setStackPolicy(policy);
+
+            for (std::size_t lane = 0; lane < Lanes; lane++) {
+                auto context = std::make_unique<chip8::Chip8Context>();
+                context->loadROM(rom.data);
+                context->setCore(chip8::Core::Table);
+                context->setStackPolicy(policy);
+
+                // Lockstep never skips idle loops.
+                context->setIdleLoopSkipping(false);
+
+                context->seedRandom(getSeed(lane));
+                m_lockstep->seedRandom(lane, getSeed(lane));
+                m_contexts.push_back(std::move(context));
+                m_reasons.push_back(chip8::StopReason::BudgetExhausted);
+            }
+        }
+
+        // One run(1) at a time, with the timers stepped between frames.
+        bool runSteps(std::uint64_t frames, Totals& totals)
+        {
+            totals.runs++;
+
+            for (std::uint64_t frame = 0; frame < frames; frame++) {
+                setKeys(frame);
+
+                for (std::uint64_t step = 0; step < CYCLES_PER_FRAME; step++) {
+                    m_lockstep->run(1);
+
+                    for (std::size_t lane = 0; lane < Lanes; lane++) {
+                        m_reasons[lane] = m_contexts[lane]->run(1);
+                    }
+
+                    if (!compare(fmt::format("frame {} step {}", frame, step), totals)) {
+                        return false;
+                    }
+                }
+
+                m_lockstep->runFrame(0);
+
+                for (std::size_t lane = 0; lane < Lanes; lane++) {
+                    m_reasons[lane] = m_contexts[lane]->runFrame(0);
+                }
+
+                if (!compare(fmt::format("frame {} timers", frame), totals)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        // Whole frames, so lanes stop partway through and get masked out.
+        bool runFrames(std::uint64_t frames, Totals& totals)
+        {
+            totals.runs++;
+
+            for (std::uint64_t frame = 0; frame < frames; frame++) {
+                setKeys(frame);
+                m_lockstep->runFrame(CYCLES_PER_FRAME);
+
+                for (std::size_t lane = 0; lane < Lanes; lane++) {
+                    m_reasons[lane] = m_contexts[lane]->runFrame(CYCLES_PER_FRAME);
+                }
+
+                if (!compare(fmt::format("frame {}", frame), totals)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+    private:
+        std::uint32_t getSeed(std::size_t lane) const
+        {
+            return m_shared ? 1 : static_cast<std::uint32_t>(lane + 1);
+        }
+
+        void setKeys(std::uint64_t frame)
+        {
+            for (std::size_t lane = 0; lane < Lanes; lane++) {
+                const auto keys = tests::getKeys(getSeed(lane), frame);
+
+                m_lockstep->setKeys(lane, keys);
+                m_contexts[lane]->setKeys(keys);
+            }
+        }
+
+        bool compare(const std::string& when, Totals& totals)
+        {
+            chip8::State expected;
+            chip8::State actual;
+            bool divergent = false;
+            bool stopped = false;
+            bool completed = false;
+
+            totals.checks++;
+
+            for (std::size_t lane = 0; lane < Lanes; lane++) {
+                m_contexts[lane]->saveState(expected);
+                m_lockstep->saveState(lane, actual);
+
+                // Idle cycles are the only thing lanes don't keep, and these
+                // contexts never have any.
+                const auto reason = m_lockstep->getStopReason(lane);
+                const auto difference = reason != m_reasons[lane]
+                    ? fmt::format("{} instead of {}", chip8::getStopReasonName(reason),
+                                  chip8::getStopReasonName(m_reasons[lane]))
+                    : tests::diffStates(expected, actual);
+
+                if (!difference.empty()) {
+                    fmt::print("FAIL {} ({}, {} lanes{}) {}: lane {} differs from its context: {}\n",
+                               m_rom.name, m_policy == chip8::StackPolicy::Wrap ? "wrap" : "trap", Lanes,
+                               m_shared ? ", shared" : "", when, lane, difference);
+                    totals.failures++;
+                    return false;
+                }
+
+                divergent |= m_lockstep->getPC(lane) != m_lockstep->getPC(0);
+                stopped |= reason != chip8::StopReason::BudgetExhausted;
+                completed |= reason == chip8::StopReason::BudgetExhausted;
+            }
+
+            // Lanes fed the same all take the same path.
+            if (m_shared && divergent) {
+                fmt::print("FAIL {} ({}) {}: identical lanes split up\n", m_rom.name, Lanes, when);
+                totals.failures++;
+                return false;
+            }
+
+            totals.divergent += divergent;
+            totals.masked += stopped && completed;
+            return true;
+        }
+
+        const tests::TestROM& m_rom;
+        chip8::StackPolicy m_policy;
+        bool m_shared;
+        std::unique_ptr<chip8::Lockstep<Lanes>> m_lockstep;
+        std::vector<std::unique_ptr<chip8::Chip8Context>> m_contexts;
+        std::vector<chip8::StopReason> m_reasons;
+    };
+
+    template<std::size_t Lanes>
+    void check(const tests::TestROM& rom, chip8::StackPolicy policy, std::uint64_t frames, Totals& totals)
+    {
+        Harness<Lanes>(rom, policy, false).runSteps(frames, totals);
+        Harness<Lanes>(rom, policy, false).runFrames(frames, totals);
+
+        Harness<Lanes>(rom, policy, true).runFrames(frames, totals);
+    }
+
+    void checkPolicies(const tests::TestROM& rom, std::uint64_t frames, Totals& totals)
+    {
+        for (auto policy : { chip8::StackPolicy::Trap, chip8::StackPolicy::Wrap }) {
+            if (policy == chip8::StackPolicy::Wrap && !rom.wrapSafe) {
+                continue;
+            }
+
+            check<8>(rom, policy, frames, totals);
+            check<32>(rom, policy, frames, totals);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Totals totals;
+
+    for (const auto& rom : tests::getFixedROMs()) {
+        checkPolicies(rom, FRAMES, totals);
+    }
+
+    for (std::uint32_t seed = 0; seed < GENERATED_ROMS; seed++) {
+        const auto rom = tests::generateROM(seed, GENERATED_LENGTH);
+
+        check<8>(rom, chip8::StackPolicy::Trap, FRAMES, totals);
+        check<16>(rom, chip8::StackPolicy::Trap, FRAMES, totals);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        tests::TestROM rom = { argv[i], {}, false };
+
+        if (!chip8::readFile(argv[i], rom.data)) {
+            fmt::print("FAIL couldn't load ROM {}\n", argv[i]);
+            totals.failures++;
+            continue;
+        }
+
+        checkPolicies(rom, GIVEN_ROM_FRAMES, totals);
+    }
+
+    // Lanes that never split up or never stop at different times would leave
+    // the interesting paths untested.
+    if (totals.divergent == 0 || totals.masked == 0) {
+        fmt::print("FAIL lanes never diverged or were never masked\n");
+        totals.failures++;
+    }
+
+    fmt::print("{}: {} runs, {} checks of every lane ({} divergent, {} masked), {} failed\n",
+               argv[0], totals.runs, totals.checks, totals.divergent, totals.masked, totals.failures);
+
+    return totals.failures == 0 ? 0 : 1;
+}
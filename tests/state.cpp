@@ -0,0 +1,121 @@
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "chip8.h"
+#include "format.h"
+#include "state.h"
+#include "testing.h"
+
+// Checks on saving and restoring states that the core comparisons can't
+// make, since every core shares the same saveState() and loadState().
+
+namespace
+{
+    std::uint64_t checks = 0;
+    std::uint64_t failures = 0;
+
+    void expect(bool condition, const std::string& what)
+    {
+        checks++;
+
+        if (!condition) {
+            fmt::print("FAIL {}\n", what);
+            failures++;
+        }
+    }
+
+    // A state with SP past the end of the stack can't have come from a
+    // context, and would let the next CALL write past it.
+    void checkStackPointer()
+    {
+        const std::vector<std::uint8_t> rom = {
+            0x22, 0x00, // 200: CALL 200
+        };
+
+        chip8::Chip8Context context;
+        context.loadROM(rom);
+        context.run(3);
+
+        chip8::State before;
+        context.saveState(before);
+
+        chip8::State corrupt = before;
+        corrupt.SP = chip8::STACK_SIZE + 1;
+
+        chip8::State after;
+        expect(!context.loadState(corrupt), "loadState() accepted SP 17");
+        context.saveState(after);
+        expect(tests::diffStates(before, after).empty(), "loadState() changed the context before rejecting SP 17");
+
+        std::stringstream file;
+        chip8::writeState(file, corrupt);
+        expect(!chip8::readState(file, after), "readState() accepted SP 17");
+
+        // A full stack is fine, and the next CALL faults rather than
+        // writing past it.
+        chip8::State full = before;
+        full.SP = chip8::STACK_SIZE;
+        expect(context.loadState(full), "loadState() rejected a full stack");
+        expect(context.run(1) == chip8::StopReason::StackFault, "CALL with a full stack didn't fault");
+    }
+
+    // A state saved while stopped on a breakpoint has to carry on past it,
+    // as the context it came from would, whether it's restored into that
+    // context (rewinding), another one or read back from a file.
+    void checkBreakpoint()
+    {
+        const std::vector<std::uint8_t> rom = {
+            0x60, 0x00, // 200: LD V0, 0
+            0x70, 0x01, // 202: ADD V0, 1
+            0x71, 0x02, // 204: ADD V1, 2
+            0x12, 0x02, // 206: JP 202
+        };
+
+        chip8::Chip8Context original;
+        original.loadROM(rom);
+        original.setBreakpoint(0x204);
+        expect(original.run(100) == chip8::StopReason::Breakpoint, "didn't stop on the breakpoint");
+
+        chip8::State saved;
+        original.saveState(saved);
+
+        std::stringstream file;
+        chip8::State read;
+        chip8::writeState(file, saved);
+        expect(chip8::readState(file, read) && tests::diffStates(saved, read).empty(),
+               "a state saved on a breakpoint didn't read back the same");
+
+        chip8::Chip8Context restored;
+        restored.loadROM(rom);
+        restored.setBreakpoint(0x204);
+        expect(restored.loadState(read), "loadState() rejected a state saved on a breakpoint");
+
+        chip8::State expected;
+        chip8::State actual;
+        const auto reason = original.run(100);
+        original.saveState(expected);
+
+        expect(reason == chip8::StopReason::Breakpoint && expected.cycles == saved.cycles + 3,
+               "didn't step over the breakpoint and stop on it a lap later");
+        expect(restored.run(100) == reason, "a restored context stopped for a different reason");
+        restored.saveState(actual);
+        expect(tests::diffStates(expected, actual).empty(), "a restored context went differently");
+
+        expect(original.loadState(saved), "loadState() rejected a state saved on a breakpoint");
+        expect(original.run(100) == reason, "a rewound context stopped for a different reason");
+        original.saveState(actual);
+        expect(tests::diffStates(expected, actual).empty(), "a rewound context went differently");
+    }
+}
+
+int main(int, char* argv[])
+{
+    checkStackPointer();
+    checkBreakpoint();
+
+    fmt::print("{}: {} checks, {} failed\n", argv[0], checks, failures);
+
+    return failures == 0 ? 0 : 1;
+}
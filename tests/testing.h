@@ -0,0 +1,280 @@
+#ifndef TESTING_H
+#define TESTING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "chip8.h"
+#include "format.h"
+
+// ROMs and helpers shared by the tests, which check the cores against each
+// other rather than against expected values: whatever the table interpreter
+// does is taken to be right, and every other way of running a ROM has to
+// reach exactly the same states.
+
+namespace tests
+{
+    struct TestROM
+    {
+        std::string name;
+        std::vector<std::uint8_t> data;
+
+        // Generated ROMs can return with an empty stack, which under Wrap
+        // sends them off into blank memory.
+        bool wrapSafe;
+    };
+
+    // Small programs that each lean on one part of the machine.
+    inline std::vector<TestROM> getFixedROMs()
+    {
+        return {
+            { "alu", {
+                0x60, 0xF0, // 200: LD V0, F0
+                0x61, 0x21, // 202: LD V1, 21
+                0x80, 0x14, // 204: ADD V0, V1
+                0x82, 0x00, // 206: LD V2, V0
+                0x82, 0x15, // 208: SUB V2, V1
+                0x83, 0x17, // 20A: SUBN V3, V1
+                0x84, 0x06, // 20C: SHR V4
+                0x85, 0x0E, // 20E: SHL V5
+                0x8F, 0x04, // 210: ADD VF, V0
+                0x80, 0xF5, // 212: SUB V0, VF
+                0x8F, 0x0E, // 214: SHL VF
+                0x86, 0x11, // 216: OR V6, V1
+                0x86, 0x22, // 218: AND V6, V2
+                0x86, 0x03, // 21A: XOR V6, V0
+                0x71, 0x07, // 21C: ADD V1, 7
+                0xA3, 0x00, // 21E: LD I, 300
+                0xF6, 0x1E, // 220: ADD I, V6
+                0xD0, 0x65, // 222: DRW V0, V6, 5
+                0x12, 0x04, // 224: JP 204
+            }, true },
+            { "timers", {
+                0x60, 0x09, // 200: LD V0, 9
+                0xF0, 0x15, // 202: LD DT, V0
+                0xF0, 0x18, // 204: LD ST, V0
+                0xF1, 0x07, // 206: LD V1, DT
+                0x31, 0x00, // 208: SE V1, 0
+                0x12, 0x06, // 20A: JP 206
+                0x72, 0x01, // 20C: ADD V2, 1
+                0xF3, 0x07, // 20E: LD V3, DT
+                0x33, 0x00, // 210: SE V3, 0
+                0x12, 0x0E, // 212: JP 20E
+                0x80, 0x24, // 214: ADD V0, V2
+                0x12, 0x02, // 216: JP 202
+            }, true },
+            { "sprites", {
+                0x00, 0xE0, // 200: CLS
+                0x60, 0x00, // 202: LD V0, 0
+                0x61, 0x00, // 204: LD V1, 0
+                0xA2, 0x00, // 206: LD I, 200
+                0xD0, 0x1F, // 208: DRW V0, V1, 15
+                0x70, 0x0B, // 20A: ADD V0, 0B
+                0x71, 0x05, // 20C: ADD V1, 5
+                0x4F, 0x01, // 20E: SNE VF, 1
+                0x72, 0x01, // 210: ADD V2, 1
+                0xD0, 0x18, // 212: DRW V0, V1, 8
+                0x32, 0x20, // 214: SE V2, 20
+                0x12, 0x08, // 216: JP 208
+                0x12, 0x00, // 218: JP 200
+            }, true },
+            // Recurses past the top of the stack, then unwinds past the
+            // bottom: stops under Trap, wraps round under Wrap.
+            { "calls", {
+                0x22, 0x06, // 200: CALL 206
+                0x70, 0x01, // 202: ADD V0, 1
+                0x12, 0x00, // 204: JP 200
+                0x71, 0x01, // 206: ADD V1, 1
+                0x31, 0x14, // 208: SE V1, 14
+                0x22, 0x06, // 20A: CALL 206
+                0x72, 0x01, // 20C: ADD V2, 1
+                0x00, 0xEE, // 20E: RET
+            }, true },
+            { "keys", {
+                0xF0, 0x0A, // 200: LD V0, K
+                0xE0, 0x9E, // 202: SKP V0
+                0x71, 0x01, // 204: ADD V1, 1
+                0xE1, 0xA1, // 206: SKNP V1
+                0x72, 0x01, // 208: ADD V2, 1
+                0xC3, 0x0F, // 20A: RND V3, 0F
+                0xE3, 0x9E, // 20C: SKP V3
+                0x12, 0x0A, // 20E: JP 20A
+                0x12, 0x00, // 210: JP 200
+            }, true },
+            { "random", {
+                0xC0, 0x3F, // 200: RND V0, 3F
+                0xC1, 0x1F, // 202: RND V1, 1F
+                0xC2, 0x03, // 204: RND V2, 03
+                0x32, 0x00, // 206: SE V2, 0
+                0x12, 0x0E, // 208: JP 20E
+                0xA2, 0x00, // 20A: LD I, 200
+                0xD0, 0x14, // 20C: DRW V0, V1, 4
+                0x42, 0x01, // 20E: SNE V2, 1
+                0x22, 0x14, // 210: CALL 214
+                0x12, 0x00, // 212: JP 200
+                0xF2, 0x18, // 214: LD ST, V2
+                0x00, 0xEE, // 216: RET
+            }, true },
+            // An opcode this machine doesn't have, run once.
+            { "unknown", {
+                0x60, 0x05, // 200: LD V0, 5
+                0x50, 0x10, // 202: (SE V0, V1)
+                0x70, 0x01, // 204: ADD V0, 1
+                0x12, 0x04, // 206: JP 204
+            }, true },
+        };
+    }
+
+    // A random program of length instructions that only jumps within itself,
+    // made of every instruction the machine has. CALLs and RETs are thrown
+    // in freely, so the stack over- and underflows.
+    inline TestROM generateROM(std::uint32_t seed, std::size_t length)
+    {
+        chip8::Random random(seed);
+        const auto pick = [&](std::uint32_t bound) { return random.next() % bound; };
+        const auto target = [&]() { return static_cast<std::uint16_t>(chip8::ROM_LOAD_ADDR + pick(length) * 2); };
+
+        std::vector<std::uint8_t> data;
+        const auto emit = [&](std::uint16_t raw) {
+            data.push_back(static_cast<std::uint8_t>(raw >> 8));
+            data.push_back(static_cast<std::uint8_t>(raw));
+        };
+
+        for (std::size_t i = 0; i < length; i++) {
+            const std::uint16_t x = pick(16) << 8;
+            const std::uint16_t y = pick(16) << 4;
+            const std::uint16_t nn = pick(256);
+
+            switch (pick(24)) {
+            case 0:  emit(pick(4) == 0 ? 0x00E0 : 0x00EE); break;
+            case 1:  emit(0x1000 | target()); break;
+            case 2:  emit(0x2000 | target()); break;
+            case 3:  emit(0x3000 | x | nn); break;
+            case 4:  emit(0x4000 | x | nn); break;
+            case 5:
+            case 6:  emit(0x6000 | x | nn); break;
+            case 7:
+            case 8:  emit(0x7000 | x | nn); break;
+            case 9:
+            case 10:
+            case 11: {
+                const std::uint16_t ops[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+                emit(0x8000 | x | y | ops[pick(9)]);
+                break;
+            }
+            case 12: emit(0xA000 | (pick(2) ? target() : pick(0x1000))); break;
+            case 13: emit(0xC000 | x | nn); break;
+            case 14:
+            case 15: emit(0xD000 | x | y | pick(16)); break;
+            case 16: emit(0xF007 | x); break;
+            case 17: emit(0xF015 | x); break;
+            case 18: emit(0xF018 | x); break;
+            case 19: emit(0xF01E | x); break;
+            case 20: emit(0xE09E | x); break;
+            case 21: emit(0xE0A1 | x); break;
+            case 22: emit(pick(4) == 0 ? 0xF00A | x : 0x6000 | x | nn); break;
+
+            // Waits on DT, so idle loop skipping gets a look in.
+            default:
+                emit(0xF007 | x);
+                emit(0x3000 | x);
+                emit(0x1000 | static_cast<std::uint16_t>(chip8::ROM_LOAD_ADDR + data.size() - 4));
+                break;
+            }
+        }
+
+        // Something that skips its last instruction still lands on a jump.
+        emit(0x1200);
+        emit(0x1200);
+
+        return { fmt::format("generated_{}", seed), data, false };
+    }
+
+    const std::uint32_t GENERATED_ROMS = 300;
+    const std::size_t GENERATED_LENGTH = 48;
+
+    // The fixed ROMs, then GENERATED_ROMS generated ones seeded 0 upwards.
+    // make test writes these out and links their AOT translations into
+    // test_cores.
+    inline std::vector<TestROM> getTestROMs()
+    {
+        auto roms = getFixedROMs();
+
+        for (std::uint32_t seed = 0; seed < GENERATED_ROMS; seed++) {
+            roms.push_back(generateROM(seed, GENERATED_LENGTH));
+        }
+
+        return roms;
+    }
+
+    // Keypad state for a frame: held for a few frames at a time, now and
+    // then nothing at all.
+    inline std::uint16_t getKeys(std::uint32_t seed, std::uint64_t frame)
+    {
+        chip8::Random random(seed ^ static_cast<std::uint32_t>(frame / 5));
+        return random.next() % 3 == 0 ? 0 : static_cast<std::uint16_t>(random.next());
+    }
+
+    // Names the first field that differs between two states, or returns an
+    // empty string if they're the same.
+    inline std::string diffStates(const chip8::State& a, const chip8::State& b)
+    {
+        for (std::size_t reg = 0; reg < chip8::NUM_GPRS; reg++) {
+            if (a.V[reg] != b.V[reg]) {
+                return fmt::format("V{:X} {:#04x} != {:#04x}", reg, unsigned(a.V[reg]), unsigned(b.V[reg]));
+            }
+        }
+
+        if (a.I != b.I) {
+            return fmt::format("I {:#05x} != {:#05x}", a.I, b.I);
+        }
+
+        if (a.PC != b.PC) {
+            return fmt::format("PC {:#05x} != {:#05x}", a.PC, b.PC);
+        }
+
+        if (a.DT != b.DT || a.ST != b.ST) {
+            return fmt::format("DT/ST {}/{} != {}/{}", unsigned(a.DT), unsigned(a.ST), unsigned(b.DT), unsigned(b.ST));
+        }
+
+        if (a.SP != b.SP || a.stack != b.stack) {
+            return fmt::format("stack (SP {} and {})", unsigned(a.SP), unsigned(b.SP));
+        }
+
+        if (a.keys != b.keys) {
+            return fmt::format("keys {:04x} != {:04x}", a.keys, b.keys);
+        }
+
+        if (a.random != b.random) {
+            return "random state";
+        }
+
+        if (a.cycles != b.cycles || a.idleCycles != b.idleCycles) {
+            return fmt::format("cycles {} ({} idle) != {} ({} idle)", a.cycles, a.idleCycles, b.cycles, b.idleCycles);
+        }
+
+        if (a.timerCountdown != b.timerCountdown) {
+            return fmt::format("timer countdown {} != {}", a.timerCountdown, b.timerCountdown);
+        }
+
+        if (a.resumeFromBreakpoint != b.resumeFromBreakpoint) {
+            return "resuming from a breakpoint";
+        }
+
+        for (std::size_t row = 0; row < chip8::FRAMEBUFFER_HEIGHT; row++) {
+            if (a.framebuffer[row] != b.framebuffer[row]) {
+                return fmt::format("framebuffer row {}", row);
+            }
+        }
+
+        if (a.memory != b.memory) {
+            return "memory";
+        }
+
+        return {};
+    }
+}
+
+#endif
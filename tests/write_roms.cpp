@@ -0,0 +1,29 @@
+#include <fstream>
+#include <string>
+
+#include "format.h"
+#include "testing.h"
+
+// Writes every ROM the tests run to <name>.ch8 in the given directory, for
+// chip8-recompile to translate. Not a test itself.
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fmt::print("Usage: {} <output directory>\n", argv[0]);
+        return 1;
+    }
+
+    for (const auto& rom : tests::getTestROMs()) {
+        const auto path = fmt::format("{}/{}.ch8", argv[1], rom.name);
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(rom.data.data()), static_cast<std::streamsize>(rom.data.size()));
+
+        if (!file) {
+            fmt::print("Couldn't write {}\n", path);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,428 @@
+// chip8-recompile: translates a CHIP-8 ROM into a C++ translation unit that
+// registers itself as an AotProgram (see src/aot.h).
+//
+// Control flow is recovered from JP, CALL, RET, SE, SNE, SKP and SKNP
+// starting at the load address. Every basic block becomes a label in a single
+// function and direct branches become gotos. Anything that can't be resolved
+// statically (RET, targets outside memory) goes back through a switch on PC,
+// and PCs that aren't known block entries are interpreted one instruction at
+// a time.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <experimental/filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "aot.h"
+#include "chip8.h"
+#include "cli.h"
+#include "format.h"
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+    using chip8::Instruction;
+    using chip8::InstructionKind;
+
+    class Recompiler
+    {
+    public:
+        explicit Recompiler(const std::vector<std::uint8_t>& rom)
+        {
+            auto num = std::min(rom.size(), chip8::ROM_MAX_SIZE);
+            std::copy_n(rom.cbegin(), num, m_memory.begin() + chip8::ROM_LOAD_ADDR);
+        }
+
+        void findBlocks()
+        {
+            std::vector<std::uint16_t> worklist = { chip8::INITIAL_PC };
+            m_leaders.insert(chip8::INITIAL_PC);
+
+            while (!worklist.empty()) {
+                auto pc = worklist.back();
+                worklist.pop_back();
+
+                for (;;) {
+                    if (!isCode(pc)) {
+                        break;
+                    }
+
+                    const auto instruction = decode(pc);
+                    const auto next = static_cast<std::uint16_t>(pc + chip8::INSTRUCTION_SIZE);
+
+                    switch (instruction.kind) {
+                    case InstructionKind::JP:
+                        addLeader(instruction.nnn, worklist);
+                        break;
+
+                    case InstructionKind::CALL:
+                        addLeader(instruction.nnn, worklist);
+                        addLeader(next, worklist);
+                        break;
+
+                    case InstructionKind::SE:
+                    case InstructionKind::SNE:
+                    case InstructionKind::SKP:
+                    case InstructionKind::SKNP:
+                        addLeader(next, worklist);
+                        addLeader(next + chip8::INSTRUCTION_SIZE, worklist);
+                        break;
+
+                    case InstructionKind::Unknown:
+                        // Stops run(), which resumes at the next instruction.
+                        addLeader(next, worklist);
+                        break;
+
+                    case InstructionKind::RET:
+                        break;
+
+                    default:
+                        pc = next;
+                        continue;
+                    }
+
+                    break;
+                }
+            }
+        }
+
+        std::string emit(const std::string& name, const std::vector<std::uint8_t>& rom) const
+        {
+            fmt::MemoryWriter out;
+
+            out << "// Generated by chip8-recompile from " << name << ". Do not edit.\n"
+                << "\n"
+                << "#include <cstdint>\n"
+                << "\n"
+                << "#include \"aot.h\"\n"
+                << "\n"
+                << "namespace\n"
+                << "{\n"
+                << "    using chip8::AotRuntime;\n"
+                << "\n"
+                << "    std::uint64_t run(chip8::Chip8Context& context, std::uint64_t budget)\n"
+                << "    {\n"
+                << "        auto& r = AotRuntime::registers(context);\n"
+                << "        auto& V = r.V;\n"
+                << "        std::uint64_t executed = 0;\n"
+                << "\n"
+                << "        goto dispatch;\n"
+                << "\n"
+                << "    interpret:\n"
+                << "        if (executed == budget) {\n"
+                << "            return executed;\n"
+                << "        }\n"
+                << "\n"
+                << "        executed += AotRuntime::interpret(context);\n"
+                << "        if (AotRuntime::stopped(context)) {\n"
+                << "            return executed;\n"
+                << "        }\n"
+                << "\n"
+                << "    dispatch:\n"
+                << "        switch (r.PC) {\n";
+
+            for (auto leader : m_leaders) {
+                out.write("        case {:#05x}: goto {};\n", leader, label(leader));
+            }
+
+            out << "        }\n"
+                << "\n"
+                << "        goto interpret;\n";
+
+            for (auto leader : m_leaders) {
+                emitBlock(out, leader);
+            }
+
+            out << "    }\n"
+                << "\n";
+
+            out.write("    const chip8::AotRegistration registration({{ \"{}\", {:#018x}ull, {}, &run }});\n",
+                      name, chip8::hashROM(rom.data(), rom.size()), rom.size());
+
+            out << "}\n";
+
+            return out.str();
+        }
+
+        std::size_t numBlocks() const
+        {
+            return m_leaders.size();
+        }
+
+    private:
+        std::array<std::uint8_t, chip8::MEMORY_SIZE> m_memory = {{ 0 }};
+        std::set<std::uint16_t> m_leaders;
+
+        static std::string label(std::uint16_t address)
+        {
+            return fmt::format("block_{:03x}", address);
+        }
+
+        // Whether there's a whole instruction at the address. The interpreter
+        // handles the odd byte at the very end of memory.
+        static bool isCode(std::uint16_t address)
+        {
+            return address + 1u < chip8::MEMORY_SIZE;
+        }
+
+        Instruction decode(std::uint16_t address) const
+        {
+            return chip8::decodeInstruction(m_memory[address] << 8 | m_memory[address + 1]);
+        }
+
+        void addLeader(std::uint16_t address, std::vector<std::uint16_t>& worklist)
+        {
+            if (isCode(address) && m_leaders.insert(address).second) {
+                worklist.push_back(address);
+            }
+        }
+
+        std::string jumpTo(std::uint16_t address) const
+        {
+            if (m_leaders.count(address)) {
+                return fmt::format("goto {};", label(address));
+            }
+
+            return fmt::format("r.PC = {:#05x}; goto dispatch;", address);
+        }
+
+        void emitBlock(fmt::MemoryWriter& out, std::uint16_t start) const
+        {
+            // Find the end first so the budget check can cover the whole block.
+            std::vector<std::uint16_t> addresses;
+            std::uint16_t pc = start;
+            bool terminated = false;
+
+            while (!terminated && isCode(pc) && (pc == start || !m_leaders.count(pc))) {
+                addresses.push_back(pc);
+
+                switch (decode(pc).kind) {
+                case InstructionKind::JP:
+                case InstructionKind::CALL:
+                case InstructionKind::SE:
+                case InstructionKind::SNE:
+                case InstructionKind::SKP:
+                case InstructionKind::SKNP:
+                case InstructionKind::RET:
+                case InstructionKind::Unknown:
+                    terminated = true;
+                    break;
+
+                default:
+                    break;
+                }
+
+                pc += chip8::INSTRUCTION_SIZE;
+            }
+
+            out << "\n";
+            out.write("    {}:\n", label(start));
+            out.write("        if (budget - executed < {}) {{\n", addresses.size());
+            out.write("            r.PC = {:#05x};\n", start);
+            out << "            goto interpret;\n"
+                << "        }\n"
+                << "\n";
+            out.write("        executed += {};\n", addresses.size());
+
+            for (std::size_t i = 0; i < addresses.size(); i++) {
+                emitInstruction(out, addresses[i], addresses.size() - i - 1);
+            }
+
+            if (!terminated) {
+                out.write("        {}\n", jumpTo(pc));
+            }
+        }
+
+        // Interprets an instruction that may stop run() without executing,
+        // in which case the rest of the block is uncounted again.
+        void emitInterpreted(fmt::MemoryWriter& out, std::uint16_t address, std::size_t following) const
+        {
+            out.write("        r.PC = {:#05x};\n", address);
+            out << "        if (!AotRuntime::interpret(context)) {\n";
+            out.write("            return executed - {};\n", following + 1);
+            out << "        }\n";
+        }
+
+        // Each translation mirrors the corresponding handler in chip8.cpp.
+        // following is the number of instructions after this one in the block,
+        // which have already been counted as executed.
+        void emitInstruction(fmt::MemoryWriter& out, std::uint16_t address, std::size_t following) const
+        {
+            const auto i = decode(address);
+            const auto next = static_cast<std::uint16_t>(address + chip8::INSTRUCTION_SIZE);
+            const auto skip = static_cast<std::uint16_t>(address + chip8::INSTRUCTION_SIZE * 2);
+
+            out.write("        // {:03x}: {:04x}\n", address, i.raw);
+
+            switch (i.kind) {
+            case InstructionKind::JP:
+                out.write("        {}\n", jumpTo(i.nnn));
+                break;
+
+            case InstructionKind::SE:
+                out.write("        if (V[{:#x}] == {:#04x}) {{ {} }}\n", i.x, i.nn, jumpTo(skip));
+                out.write("        {}\n", jumpTo(next));
+                break;
+
+            case InstructionKind::SNE:
+                out.write("        if (V[{:#x}] != {:#04x}) {{ {} }}\n", i.x, i.nn, jumpTo(skip));
+                out.write("        {}\n", jumpTo(next));
+                break;
+
+            case InstructionKind::SKP:
+                out.write("        if (AotRuntime::isKeyPressed(context, V[{:#x}])) {{ {} }}\n", i.x, jumpTo(skip));
+                out.write("        {}\n", jumpTo(next));
+                break;
+
+            case InstructionKind::SKNP:
+                out.write("        if (!AotRuntime::isKeyPressed(context, V[{:#x}])) {{ {} }}\n", i.x, jumpTo(skip));
+                out.write("        {}\n", jumpTo(next));
+                break;
+
+            case InstructionKind::LD_V_K:
+                emitInterpreted(out, address, following);
+                break;
+
+            case InstructionKind::Unknown:
+                // Always ends the block and stops run().
+                out.write("        r.PC = {:#05x};\n", address);
+                out << "        AotRuntime::interpret(context);\n"
+                    << "        return executed;\n";
+                break;
+
+            case InstructionKind::CALL:
+                // Interpreted so that stack faults go through the policy.
+                emitInterpreted(out, address, following);
+                out.write("        {}\n", jumpTo(i.nnn));
+                break;
+
+            case InstructionKind::RET:
+                emitInterpreted(out, address, following);
+                out << "        goto dispatch;\n";
+                break;
+
+            case InstructionKind::LD:
+                out.write("        V[{:#x}] = {:#04x};\n", i.x, i.nn);
+                break;
+
+            case InstructionKind::ADD:
+                out.write("        V[{:#x}] += {:#04x};\n", i.x, i.nn);
+                break;
+
+            case InstructionKind::LD_VV:
+                out.write("        V[{:#x}] = V[{:#x}];\n", i.x, i.y);
+                break;
+
+            case InstructionKind::OR:
+                out.write("        V[{:#x}] |= V[{:#x}];\n", i.x, i.y);
+                break;
+
+            case InstructionKind::AND:
+                out.write("        V[{:#x}] &= V[{:#x}];\n", i.x, i.y);
+                break;
+
+            case InstructionKind::XOR:
+                out.write("        V[{:#x}] ^= V[{:#x}];\n", i.x, i.y);
+                break;
+
+            case InstructionKind::ADD_VV:
+                out.write("        {{ std::uint16_t temp = V[{0:#x}] + V[{1:#x}]; V[0xf] = (temp & 0xFF00) ? 1 : 0; V[{0:#x}] = temp & 0x00FF; }}\n",
+                          i.x, i.y);
+                break;
+
+            case InstructionKind::SUB:
+                out.write("        V[0xf] = (V[{0:#x}] > V[{1:#x}]) ? 1 : 0;\n", i.x, i.y);
+                out.write("        V[{0:#x}] -= V[{1:#x}];\n", i.x, i.y);
+                break;
+
+            case InstructionKind::SHR:
+                out.write("        V[0xf] = V[{0:#x}] & 1;\n", i.x);
+                out.write("        V[{0:#x}] >>= 1;\n", i.x);
+                break;
+
+            case InstructionKind::SUBN:
+                out.write("        V[0xf] = (V[{1:#x}] > V[{0:#x}]) ? 1 : 0;\n", i.x, i.y);
+                out.write("        V[{0:#x}] = V[{1:#x}] - V[{0:#x}];\n", i.x, i.y);
+                break;
+
+            case InstructionKind::SHL:
+                out.write("        V[0xf] = V[{0:#x}] & 0x80;\n", i.x);
+                out.write("        V[{0:#x}] <<= 1;\n", i.x);
+                break;
+
+            case InstructionKind::LDI:
+                out.write("        r.I = {:#05x};\n", i.nnn);
+                break;
+
+            case InstructionKind::ADD_I_V:
+                out.write("        r.I += V[{:#x}];\n", i.x);
+                break;
+
+            case InstructionKind::LD_V_DT:
+                if (chip8::isIdleLoop(address, m_memory.data())) {
+                    // Let the interpreter stop here so run() can fast-forward
+                    // the loop.
+                    emitInterpreted(out, address, following);
+                } else {
+                    out.write("        V[{:#x}] = r.DT;\n", i.x);
+                }
+                break;
+
+            case InstructionKind::LD_DT_V:
+                out.write("        r.DT = V[{:#x}];\n", i.x);
+                break;
+
+            case InstructionKind::LD_ST_V:
+                out.write("        r.ST = V[{:#x}];\n", i.x);
+                break;
+
+            case InstructionKind::DRW:
+                out.write("        AotRuntime::drawSprite(context, V[{:#x}], V[{:#x}], {});\n", i.x, i.y, i.n);
+                break;
+
+            default:
+                // CLS and RND run through the interpreter, which leaves PC on
+                // the next instruction.
+                out.write("        r.PC = {:#05x};\n", address);
+                out << "        AotRuntime::interpret(context);\n";
+                break;
+            }
+        }
+    };
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        fmt::print("Usage: {} <path to ROM> <output.cpp>\n", argv[0]);
+        return 1;
+    }
+
+    auto romPath = fs::path(argv[1]);
+
+    std::vector<std::uint8_t> rom;
+    if (!chip8::readFile(argv[1], rom)) {
+        fmt::print("Couldn't load ROM {}\n", argv[1]);
+        return 1;
+    }
+
+    Recompiler recompiler(rom);
+    recompiler.findBlocks();
+
+    std::ofstream output(argv[2]);
+    output << recompiler.emit(romPath.filename().string(), rom);
+
+    if (!output) {
+        fmt::print("Couldn't write {}\n", argv[2]);
+        return 1;
+    }
+
+    fmt::print("{}: {} blocks\n", romPath.filename().string(), recompiler.numBlocks());
+
+    return 0;
+}